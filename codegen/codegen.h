@@ -8,12 +8,68 @@
 
 extern SymbolTable* symbol_table;
 
+/** The stack frame of a procedure is like:
+ * 
+ *  --------------------------   <---- sp register at entry
+ *        return address
+ *    (if the procedure calls
+ *      another procedure)
+ *  --------------------------
+ *  saved s1, s2, s3, s4 registers
+ *    (only those being used)
+ *  --------------------------
+ *     potential free space
+ *       due to alignment
+ *  --------------------------
+ *       allocated_memory
+ *  --------------------------
+ *        spilled_memory
+ *  --------------------------
+ *   place to save t0-t6 that
+ *     are live across calls
+ *  --------------------------
+ *       place to save >8 
+ *           func args
+ *  --------------------------   <---- sp register here
+ * 
+ *  All offsets are known at compile time, so everything is addressed from
+ *  sp and no frame pointer is needed. A leaf procedure that uses no memory
+ *  and no callee-saved register has no frame at all, and paths of other
+ *  procedures that do not need the frame may run before it is set up.
+ *
+ *  Parts of a large frame that are 2048 bytes or more above sp are out of
+ *  reach of an immediate offset. If they are accessed more than once, the
+ *  prologue points s4 into them, and they are addressed from s4 instead.
+ */
+struct Frame
+{
+    /* Name of the procedure. */
+    std::string name;
+    /* Bytes subtracted from sp by the prologue. */
+    std::size_t size;
+    std::size_t exceeding_args;
+    std::size_t call_saves;
+    std::size_t spilled;
+    /* Bytes above sp that s4 points to, or 0 if s4 is not used as a base. */
+    std::size_t base;
+    /* Registers saved by the prologue, from the top of the frame down. */
+    std::vector<std::string> saved;
+    /* Last instruction of the procedure, which the epilogue follows. */
+    IntermediateCode* last;
+    /* Instruction before which the prologue goes, see 'shrink_wrap', whether
+       it goes before the labels of that instruction, and the returns reached
+       after it, which go through the epilogue. */
+    IntermediateCode* prologue_at;
+    bool prologue_before_labels;
+    std::set<IntermediateCode*> framed_returns;
+    /* Conditional jumps whose target is out of reach of a branch, see
+       'relax_branches'. */
+    std::set<IntermediateCode*> long_branches;
+};
+
 std::string to_asm(IntermediateCode* code, 
-                   std::size_t all_subtracted,
-                   std::size_t all_spilled,
-                   std::size_t all_exceeding_args,
-                   int has_call,
-                   std::size_t& already_allocated);
+                   const Frame& frame,
+                   const std::set<std::size_t>& caller_saved);
 
 struct CodeGenerator
 {
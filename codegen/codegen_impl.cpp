@@ -1,4 +1,5 @@
 #include "codegen.h"
+#include <algorithm>
 
 CodeGenerator::CodeGenerator(const std::vector<IntermediateCode*>& _code)
 {
@@ -13,8 +14,438 @@ CodeGenerator::~CodeGenerator()
     }
 }
 
+/**
+ *  Registers to save around every call of a procedure: the temporary registers
+ *  that are live across the call and that the callee may write.
+ */
+static std::map<IntermediateCode*, std::set<std::size_t>>
+saved_around_calls(Procedure* func, const std::map<std::size_t, std::set<std::size_t>>& clobbers)
+{
+    std::map<IntermediateCode*, std::set<std::size_t>> saved;
+    auto blocks = make_basic_blocks(func->code);
+    LivenessUpdater updater(blocks);
+    updater.calculate_liveness();
+    for (std::size_t b = 0; b < blocks.size(); b++)
+    {
+        auto& block_code = blocks[b]->code;
+        for (std::size_t k = 0; k < block_code.size(); k++)
+        {
+            auto code_line = block_code[k];
+            if (code_line->instr != INSTR_CALL)
+                continue;
+            auto it = clobbers.find(code_line->loperand);
+            auto& regs = saved[code_line];
+            /* Liveness of a block is kept in reversed order. */
+            for (auto& reg: updater.liveness[b][block_code.size() - k - 1])
+            {
+                if (reg >= 1 && reg <= 7 && reg != code_line->dest &&
+                    (it == clobbers.end() || it->second.count(reg) > 0))
+                    regs.insert(reg);
+            }
+        }
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+    return saved;
+}
+
+/* Whether an instruction accesses the frame or a register saved in it. */
+static bool needs_frame(IntermediateCode* code)
+{
+    switch (code->instr)
+    {
+        case INSTR_SAVE:
+        case INSTR_LOADD:
+        case INSTR_LOADO:
+        case INSTR_ALLOC:
+        case INSTR_CALL:
+            return true;
+        case INSTR_ARG:
+            if (code->loperand >= 8)
+                return true;
+            break;
+        case INSTR_LARG:
+            if (code->roperand >= 8)
+                return true;
+            break;
+    }
+    auto regs = use(code);
+    auto defs = def(code);
+    regs.insert(defs.begin(), defs.end());
+    return regs.count(DEST_TEMP) > 0 || regs.count(OPERAND_TEMP) > 0;
+}
+
+/**
+ *  Shrink-wrapping: place the prologue at the start of the block nearest to
+ *  the entry that dominates every block needing the frame, so that paths
+ *  avoiding those blocks run without stack traffic. The blocks dominated by
+ *  the chosen block must only be left through returns, which then restore
+ *  the frame, and must not jump back to the chosen block. Otherwise we move
+ *  on to its immediate dominator, until we reach the entry. If even the entry
+ *  is jumped back to, as the header of a loop, its prologue goes before its
+ *  labels, so that those jumps skip it.
+ */
+static void shrink_wrap(Procedure* func, Frame& frame)
+{
+    frame.prologue_at = nullptr;
+    frame.prologue_before_labels = false;
+    if (frame.size == 0)
+        return;
+    auto blocks = make_basic_blocks(func->code);
+    DominatorTree dom_tree(blocks);
+    auto num_blocks = blocks.size();
+    auto exit_block = num_blocks - 1;
+
+    auto wrap = num_blocks;
+    for (std::size_t b = 0; b < exit_block; b++)
+    {
+        if (!dom_tree.reachable(b))
+            continue;
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (needs_frame(code_line))
+            {
+                wrap = (wrap == num_blocks) ? b : dom_tree.common_dominator(wrap, b);
+                break;
+            }
+        }
+    }
+    while (wrap != num_blocks)
+    {
+        bool closed = true;
+        for (std::size_t b = 0; b < exit_block && closed; b++)
+        {
+            if (!dom_tree.reachable(b) || !dom_tree.dominates(wrap, b))
+                continue;
+            for (auto& s: blocks[b]->successors)
+            {
+                if (s != exit_block && (s == wrap || !dom_tree.dominates(wrap, s)))
+                    closed = false;
+            }
+        }
+        if (closed)
+            break;
+        if (wrap == 0)
+        {
+            frame.prologue_before_labels = true;
+            break;
+        }
+        wrap = dom_tree.idom[wrap];
+    }
+
+    if (wrap != num_blocks)
+    {
+        frame.prologue_at = blocks[wrap]->code[0];
+        for (std::size_t b = 0; b < exit_block; b++)
+        {
+            if (!dom_tree.reachable(b) || !dom_tree.dominates(wrap, b))
+                continue;
+            for (auto& code_line: blocks[b]->code)
+            {
+                if (code_line->instr == INSTR_RET)
+                    frame.framed_returns.insert(code_line);
+            }
+        }
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
+
+/**
+ *  Lay out the stack frame of a procedure, given the registers saved around
+ *  each of its calls.
+ */
+static Frame make_frame(const std::string& name, Procedure* func,
+                        const std::map<IntermediateCode*, std::set<std::size_t>>& saved)
+{
+    Frame frame;
+    frame.name = name;
+    frame.base = 0;
+    frame.last = func->code.size() > 0 ? func->code.back() : nullptr;
+    auto max_args = func->max_call_args();
+    frame.exceeding_args = max_args > 8 ? (max_args - 8) * INT_SIZE : 0;
+    std::size_t max_saved = 0;
+    for (auto& pair: saved)
+    {
+        for (auto& reg: pair.second)
+        {
+            if (reg > max_saved)
+                max_saved = reg;
+        }
+    }
+    frame.call_saves = INT_SIZE * max_saved;
+    frame.spilled = func->max_spilled_memory();
+    auto allocated = func->max_allocated_memory();
+
+    /* Find the callee-saved registers the code uses, and the offsets of the
+       frame accesses: from sp, and for arguments on the stack, from the top
+       of the frame. */
+    bool uses_dest_temp = false, uses_operand_temp = false;
+    std::vector<std::size_t> offsets, save_offsets, larg_offsets;
+    auto below_spilled = frame.exceeding_args + frame.call_saves;
+    for (auto& code_line: func->code)
+    {
+        auto regs = use(code_line);
+        auto defs = def(code_line);
+        regs.insert(defs.begin(), defs.end());
+        switch (code_line->instr)
+        {
+            case INSTR_SAVE:
+                regs.insert(DEST_TEMP);
+                offsets.push_back(below_spilled + code_line->loperand);
+                save_offsets.push_back(below_spilled + code_line->loperand);
+                break;
+            case INSTR_LOADD:
+                regs.insert(DEST_TEMP);
+                offsets.push_back(below_spilled + code_line->roperand);
+                break;
+            case INSTR_LOADO:
+                regs.insert(OPERAND_TEMP);
+                offsets.push_back(below_spilled + code_line->roperand);
+                break;
+            case INSTR_ALLOC:
+                offsets.push_back(below_spilled + frame.spilled + code_line->roperand);
+                break;
+            case INSTR_LARG:
+                if (code_line->roperand >= 8)
+                    larg_offsets.push_back((code_line->roperand - 8) * INT_SIZE);
+                break;
+        }
+        if (regs.count(DEST_TEMP) > 0)
+            uses_dest_temp = true;
+        if (regs.count(OPERAND_TEMP) > 0)
+            uses_operand_temp = true;
+    }
+    if (func->has_call())
+        frame.saved.push_back("ra");
+    if (uses_dest_temp)
+        frame.saved.push_back("s1");
+    if (uses_operand_temp)
+        frame.saved.push_back("s2");
+
+    auto size_of = [&frame, allocated](std::size_t num_saved)
+    {
+        std::size_t size = frame.exceeding_args + frame.call_saves +
+                           frame.spilled + allocated + INT_SIZE * num_saved;
+        return (size + 15) / 16 * 16;
+    };
+
+    /* s4 is the base register of the far part of the frame, and s3 holds
+       large offsets where neither sp nor s4 is close enough. Both change the
+       size of the frame, and so the offsets of the arguments on the stack,
+       so repeat until neither decision changes. */
+    auto num_saved = frame.saved.size();
+    bool uses_base = false, uses_scratch = false;
+    while (true)
+    {
+        frame.size = size_of(num_saved + uses_base + uses_scratch);
+        std::vector<std::size_t> far;
+        for (auto& offset: offsets)
+        {
+            if (offset >= 2048)
+                far.push_back(offset);
+        }
+        for (auto& offset: larg_offsets)
+        {
+            if (frame.size + offset >= 2048)
+                far.push_back(frame.size + offset);
+        }
+        /* The base is set up once, which pays off from the second access. */
+        frame.base = far.size() >= 2 ? *std::min_element(far.begin(), far.end()) + 2047 : 0;
+        bool needs_scratch = frame.size >= 2048;
+        for (auto& offset: save_offsets)
+        {
+            if (offset >= 2048 && (frame.base == 0 || offset > frame.base + 2047))
+                needs_scratch = true;
+        }
+        auto needs_base = frame.base > 0;
+        if ((!needs_base || uses_base) && (!needs_scratch || uses_scratch))
+            break;
+        uses_base = uses_base || needs_base;
+        uses_scratch = uses_scratch || needs_scratch;
+    }
+    if (uses_scratch)
+        frame.saved.push_back("s3");
+    if (uses_base)
+        frame.saved.push_back("s4");
+    shrink_wrap(func, frame);
+    return frame;
+}
+
+/**
+ *  The prologue moves sp and saves the registers of 'frame.saved' at the top
+ *  of the frame. If the frame is too large for immediate offsets, the
+ *  registers are saved before sp is moved.
+ */
+static std::string prologue(const Frame& frame)
+{
+    std::string result;
+    if (frame.size == 0)
+        return result;
+    auto num_saved = frame.saved.size();
+    if (frame.size <= 2048)
+    {
+        result += "  addi sp, sp, " + std::to_string(-(int)frame.size) + "\n";
+        for (std::size_t i = 0; i < num_saved; i++)
+        {
+            auto offset = frame.size - INT_SIZE * (i + 1);
+            result += "  sw   " + frame.saved[i] + ", " + std::to_string((int)offset) + "(sp)\n";
+        }
+    }
+    else
+    {
+        for (std::size_t i = 0; i < num_saved; i++)
+        {
+            auto offset = INT_SIZE * (i + 1);
+            result += "  sw   " + frame.saved[i] + ", " + std::to_string(-(int)offset) + "(sp)\n";
+        }
+        result += "  li   s3, " + std::to_string((int)frame.size) + "\n"
+                + "  sub  sp, sp, s3\n";
+    }
+    if (frame.base > 0)
+    {
+        result += "  li   s4, " + std::to_string((int)frame.base) + "\n"
+                + "  add  s4, sp, s4\n";
+    }
+    return result;
+}
+
+/**
+ *  Operand of a load or store of the word 'up_from_sp' bytes above sp, from
+ *  sp or from the base register s4. Empty if neither is close enough.
+ */
+static std::string frame_operand(const Frame& frame, std::size_t up_from_sp)
+{
+    if (up_from_sp < 2048)
+        return std::to_string((int)up_from_sp) + "(sp)";
+    auto from_base = (int)up_from_sp - (int)frame.base;
+    if (frame.base > 0 && from_base >= -2048 && from_base < 2048)
+        return std::to_string(from_base) + "(s4)";
+    return "";
+}
+
+/* Load of a word of the frame into 'reg', which holds its address if the
+   word is out of reach of both sp and s4. */
+static std::string load_from_frame(const Frame& frame, const std::string& reg, std::size_t up_from_sp)
+{
+    auto operand = frame_operand(frame, up_from_sp);
+    if (operand != "")
+        return "  lw   " + reg + ", " + operand;
+    return "  li   " + reg + ", " + std::to_string((int)up_from_sp) + "\n"
+         + "  add  " + reg + ", sp, " + reg + "\n"
+         + "  lw   " + reg + ", 0(" + reg + ")";
+}
+
+/* The epilogue shared by all returns of a procedure with a frame. */
+static std::string epilogue(const Frame& frame)
+{
+    std::string result;
+    auto num_saved = frame.saved.size();
+    if (frame.size < 2048)
+    {
+        for (std::size_t i = 0; i < num_saved; i++)
+        {
+            auto offset = frame.size - INT_SIZE * (i + 1);
+            result += "  lw   " + frame.saved[i] + ", " + std::to_string((int)offset) + "(sp)\n";
+        }
+        result += "  addi sp, sp, " + std::to_string((int)frame.size) + "\n";
+    }
+    else
+    {
+        result += "  li   s3, " + std::to_string((int)frame.size) + "\n"
+                + "  add  sp, sp, s3\n";
+        for (std::size_t i = 0; i < num_saved; i++)
+        {
+            auto offset = INT_SIZE * (i + 1);
+            result += "  lw   " + frame.saved[i] + ", " + std::to_string(-(int)offset) + "(sp)\n";
+        }
+    }
+    return result + "  ret\n";
+}
+
+/* Bytes of machine code of the assembly of an instruction. */
+static std::size_t asm_size(const std::string& asm_code)
+{
+    std::size_t size = 0;
+    std::size_t begin = 0;
+    while (begin < asm_code.size())
+    {
+        auto end = asm_code.find('\n', begin);
+        if (end == std::string::npos)
+            end = asm_code.size();
+        auto line = asm_code.substr(begin, end - begin);
+        begin = end + 1;
+        if (line.size() == 0 || line.back() == ':')
+            continue;
+        size += INT_SIZE;
+        /* Pseudo-instructions that expand to two instructions. */
+        if (line.compare(0, 7, "  la   ") == 0 || line.compare(0, 7, "  call ") == 0)
+        {
+            size += INT_SIZE;
+        }
+        else if (line.compare(0, 7, "  li   ") == 0)
+        {
+            auto value = std::stoll(line.substr(line.find(',') + 1));
+            if (value < -2048 || value >= 2048)
+                size += INT_SIZE;
+        }
+    }
+    return size;
+}
+
+/**
+ *  Branch relaxation. Conditional jumps are emitted as a single branch, which
+ *  reaches 4 KiB either way; those with a target further away become a branch
+ *  over a 'j', which reaches 1 MiB. Since making a jump longer moves other
+ *  targets further away, repeat until no jump has to change.
+ */
+static void relax_branches(Procedure* func, Frame& frame,
+                           std::map<IntermediateCode*, std::set<std::size_t>>& saved)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        /* Address of every label, and of the last instruction of every
+           conditional jump, from the start of the procedure. */
+        std::map<std::size_t, std::size_t> label_addr;
+        std::map<IntermediateCode*, std::size_t> branch_addr;
+        std::size_t addr = 0;
+        for (auto& line: func->code)
+        {
+            for (auto& label: line->labels)
+            {
+                label_addr[label] = addr;
+            }
+            addr += asm_size(to_asm(line, frame, saved[line]));
+            if (line->instr == INSTR_JE || line->instr == INSTR_JNE ||
+                IS_COMPARE_JUMP(line->instr))
+                branch_addr[line] = addr - INT_SIZE;
+        }
+        for (auto& pair: branch_addr)
+        {
+            if (frame.long_branches.count(pair.first) > 0)
+                continue;
+            auto it = label_addr.find(pair.first->roperand);
+            if (it == label_addr.end())
+                continue;
+            auto distance = (long long)it->second - (long long)pair.second;
+            if (distance < -4096 || distance >= 4096)
+            {
+                frame.long_branches.insert(pair.first);
+                changed = true;
+            }
+        }
+    }
+}
+
 void CodeGenerator::generate_code(std::ostream& file)
 {
+    auto clobbers = clobber_summaries(procedures);
     std::size_t func_idx = 0;
     for (auto& entry: symbol_table->get_entries())
     {
@@ -63,46 +494,22 @@ void CodeGenerator::generate_code(std::ostream& file)
             file << "  .text\n"
                  << "  .globl " + entry->name + "\n"
                  << entry->name + ":\n";
-            /* Generate function prologue. */
-            auto stack_mov = func->stack_move_value(),
-                 max_alloc = func->max_allocated_memory(),
-                 max_spill = func->max_spilled_memory(),
-                 max_args = func->max_call_args();
-            std::size_t exceeding_args = 0;
-            bool has_call = func->has_call();
-            if (max_args > 8)
-            {
-                exceeding_args += (max_args - 8) * INT_SIZE;
-            }
-            if (has_call)
-            {
-                file << "  sw   s3, -8(sp)\n"
-                     << "  sw   s2, -12(sp)\n"
-                     << "  sw   s1, -16(sp)\n"
-                     << "  sw   s0, -20(sp)\n"
-                     << "  addi s0, sp, -20\n";
-            }
-            else
-            {
-                file << "  sw   s3, -4(sp)\n"
-                     << "  sw   s2, -8(sp)\n"
-                     << "  sw   s1, -12(sp)\n"
-                     << "  sw   s0, -16(sp)\n"
-                     << "  addi s0, sp, -16\n";
-            }
-            if (stack_mov <= 2048)
-            {
-                file << "  addi sp, sp, " + std::to_string(-(int)(stack_mov)) + "\n";
-            }
-            else
+            auto saved = saved_around_calls(func, clobbers);
+            auto frame = make_frame(entry->name, func, saved);
+            relax_branches(func, frame, saved);
+            for (auto& line: func->code)
             {
-                file << "  li   s3, " + std::to_string((int)stack_mov) + "\n"
-                     << "  sub  sp, sp, s3\n";
+                /* An instruction lowered to nothing leaves only its labels,
+                   which end with a newline already. */
+                auto asm_code = to_asm(line, frame, saved[line]);
+                if (asm_code.size() > 0 && asm_code.back() != '\n')
+                    asm_code += "\n";
+                file << asm_code;
             }
-            std::size_t already_alloc = 0;
-            for (auto& line: func->code)
+            if (frame.framed_returns.size() > 0)
             {
-                file << to_asm(line, stack_mov, max_spill, exceeding_args, has_call, already_alloc) << "\n";
+                file << entry->name + "_epilogue:\n"
+                     << epilogue(frame);
             }
             file << "\n";            
         }
@@ -134,6 +541,8 @@ static std::string reg_to_str(std::size_t reg)
         return "t" + std::to_string(reg - 1);
     else if (reg >= 8 && reg <= 9) /* s1 to s2 */
         return "s" + std::to_string(reg - 7);
+    else if (reg >= ARG_REGISTER(0) && reg <= ARG_REGISTER(7)) /* a0 to a7 */
+        return "a" + std::to_string(reg - ARG_REGISTER(0));
     return "%" + std::to_string(reg);
 }
 
@@ -145,17 +554,16 @@ static std::string arg_to_str(std::size_t arg)
 }
 
 std::string to_asm(IntermediateCode* code, 
-                   std::size_t all_subtracted,
-                   std::size_t all_spilled,
-                   std::size_t all_exceeding_args,
-                   int has_call,
-                   std::size_t& already_allocated)
+                   const Frame& frame,
+                   const std::set<std::size_t>& caller_saved)
 {
     auto labels = code->labels;
     auto dest = code->dest, instr = code->instr, 
          loperand = code->loperand, roperand = code->roperand;
 
     std::string prefix;
+    if (code == frame.prologue_at && frame.prologue_before_labels)
+        prefix += prologue(frame);
     for (auto& label: labels)
     {
         if (label > 0)
@@ -163,6 +571,8 @@ std::string to_asm(IntermediateCode* code,
             prefix += (label_to_str(label) + ":\n");
         }
     }
+    if (code == frame.prologue_at && !frame.prologue_before_labels)
+        prefix += prologue(frame);
     switch (instr)
     {
         case INSTR_IRMOV:
@@ -178,48 +588,28 @@ std::string to_asm(IntermediateCode* code,
             return prefix + "  lw   " + reg_to_str(dest) + ", 0(" + reg_to_str(loperand) + ")";
         case INSTR_SAVE:
         {
-            auto up_from_sp = all_exceeding_args + loperand;
-            if (up_from_sp < 2048)
+            auto up_from_sp = frame.exceeding_args + frame.call_saves + loperand;
+            auto operand = frame_operand(frame, up_from_sp);
+            if (operand != "")
             {
-                return prefix + "  sw   s1, " + std::to_string((int)up_from_sp) + "(sp)";
+                return prefix + "  sw   s1, " + operand;
             }
             else
             {
                 return prefix + "  li   s3, " + std::to_string((int)up_from_sp) + "\n"
-                     + "  add  sp, sp, s3\n"
-                     + "  sw   s1, 0(sp)\n"
-                     + "  sub  sp, sp, s3";
+                     + "  add  s3, sp, s3\n"
+                     + "  sw   s1, 0(s3)";
             }
         }
         case INSTR_LOADD:
         {
-            auto up_from_sp = all_exceeding_args + roperand;
-            if (up_from_sp < 2048)
-            {
-                return prefix + "  lw   s1, " + std::to_string((int)up_from_sp) + "(sp)";
-            }
-            else
-            {
-                return prefix + "  li   s3, " + std::to_string((int)up_from_sp) + "\n"
-                     + "  add  sp, sp, s3\n"
-                     + "  lw   s1, 0(sp)\n"
-                     + "  sub  sp, sp, s3";
-            }
+            auto up_from_sp = frame.exceeding_args + frame.call_saves + roperand;
+            return prefix + load_from_frame(frame, "s1", up_from_sp);
         }
         case INSTR_LOADO:
         {
-            auto up_from_sp = all_exceeding_args + roperand;
-            if (up_from_sp < 2048)
-            {
-                return prefix + "  lw   s2, " + std::to_string((int)up_from_sp) + "(sp)";
-            }
-            else
-            {
-                return prefix + "  li   s3, " + std::to_string((int)up_from_sp) + "\n"
-                     + "  add  sp, sp, s3\n"
-                     + "  lw   s2, 0(sp)\n"
-                     + "  sub  sp, sp, s3";
-            }
+            auto up_from_sp = frame.exceeding_args + frame.call_saves + roperand;
+            return prefix + load_from_frame(frame, "s2", up_from_sp);
         }
         case INSTR_NEG:
             return prefix + "  sub  " + reg_to_str(dest) + ", x0, " + reg_to_str(loperand);
@@ -253,38 +643,77 @@ std::string to_asm(IntermediateCode* code,
         case INSTR_NEQ:
             return prefix + "  xor  " + reg_to_str(dest) + ", " + reg_to_str(loperand) + ", " + reg_to_str(roperand) + "\n"
                  + "  snez " + reg_to_str(dest) + ", " + reg_to_str(dest);
+        case INSTR_SLL:
+            return prefix + "  slli " + reg_to_str(dest) + ", " + reg_to_str(loperand) + ", " + std::to_string(roperand);
+        case INSTR_SRL:
+            return prefix + "  srli " + reg_to_str(dest) + ", " + reg_to_str(loperand) + ", " + std::to_string(roperand);
+        case INSTR_SRA:
+            return prefix + "  srai " + reg_to_str(dest) + ", " + reg_to_str(loperand) + ", " + std::to_string(roperand);
+        case INSTR_MULH:
+            return prefix + "  mulh " + reg_to_str(dest) + ", " + reg_to_str(loperand) + ", " + reg_to_str(roperand);
         case INSTR_ALLOC:
         {
-            auto up_from_sp = all_exceeding_args + all_spilled + already_allocated;
-            already_allocated += loperand;
+            auto up_from_sp = frame.exceeding_args + frame.call_saves + frame.spilled + roperand;
+            auto from_base = (int)up_from_sp - (int)frame.base;
             if (up_from_sp < 2048)
             {
                 return prefix + "  addi " + reg_to_str(dest) + ", sp, " + std::to_string((int)up_from_sp);
             }
+            else if (frame.base > 0 && from_base >= -2048 && from_base < 2048)
+            {
+                return prefix + "  addi " + reg_to_str(dest) + ", s4, " + std::to_string(from_base);
+            }
             else
             {
-                return prefix + "  li   s3, " + std::to_string((int)up_from_sp) + "\n"
-                     + "  add  " + reg_to_str(dest) + ", sp, s3";
+                return prefix + "  li   " + reg_to_str(dest) + ", " + std::to_string((int)up_from_sp) + "\n"
+                     + "  add  " + reg_to_str(dest) + ", sp, " + reg_to_str(dest);
             }
         }
         case INSTR_JMP:
-                // return prefix + "  j    " + label_to_str(roperand);
-                return prefix + "  la   s3, " + label_to_str(roperand) + "\n"
-                     + "  jr   s3";
+                return prefix + "  j    " + label_to_str(roperand);
         case INSTR_JE:
-                // return prefix + "  beqz " + reg_to_str(loperand) + ", " + label_to_str(roperand);
-                return prefix + "  la   s3, " + label_to_str(roperand) + "\n" +  
-                     + "  bnez " + reg_to_str(loperand) + ", 8\n"
-                     + "  jr   s3";
+            if (frame.long_branches.count(code) == 0)
+                return prefix + "  beqz " + reg_to_str(loperand) + ", " + label_to_str(roperand);
+            return prefix + "  bnez " + reg_to_str(loperand) + ", 8\n"
+                 + "  j    " + label_to_str(roperand);
         case INSTR_JNE:
-                // return prefix + "  bnez " + reg_to_str(loperand) + ", " + label_to_str(roperand);
-                return prefix + "  la   s3, " + label_to_str(roperand) + "\n" +  
-                     + "  beqz " + reg_to_str(loperand) + ", 8\n"
-                     + "  jr   s3";
+            if (frame.long_branches.count(code) == 0)
+                return prefix + "  bnez " + reg_to_str(loperand) + ", " + label_to_str(roperand);
+            return prefix + "  beqz " + reg_to_str(loperand) + ", 8\n"
+                 + "  j    " + label_to_str(roperand);
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
+        {
+            /* The branch, and the opposite branch to jump over a 'j' if the
+               target is too far. */
+            std::string branch, opposite;
+            switch (instr)
+            {
+                case INSTR_JGT:  branch = "bgt "; opposite = "ble "; break;
+                case INSTR_JGEQ: branch = "bge "; opposite = "blt "; break;
+                case INSTR_JLT:  branch = "blt "; opposite = "bge "; break;
+                case INSTR_JLEQ: branch = "ble "; opposite = "bgt "; break;
+                case INSTR_JEQ:  branch = "beq "; opposite = "bne "; break;
+                default:         branch = "bne "; opposite = "beq "; break;
+            }
+            auto operands = reg_to_str(dest) + ", " + reg_to_str(loperand);
+            if (frame.long_branches.count(code) == 0)
+                return prefix + "  " + branch + operands + ", " + label_to_str(roperand);
+            return prefix + "  " + opposite + operands + ", 8\n"
+                 + "  j    " + label_to_str(roperand);
+        }
         case INSTR_ARG:
         {
             if (loperand >= 0 && loperand <= 7)
+            {
+                if (roperand == ARG_REGISTER(loperand))
+                    return prefix;
                 return prefix + "  mv   " + arg_to_str(loperand) + ", " + reg_to_str(roperand);
+            }
             else
             {
                 auto up_from_sp = (loperand - 8) * INT_SIZE;
@@ -294,54 +723,50 @@ std::string to_asm(IntermediateCode* code,
         case INSTR_LARG:
         {
             if (roperand >= 0 && roperand <= 7)
+            {
+                if (loperand == ARG_REGISTER(roperand))
+                    return prefix;
                 return prefix + "  mv   " + reg_to_str(loperand) + ", " + arg_to_str(roperand);
+            }
             else
             {
-                auto up_from_s0 = (roperand - 4 + has_call) * INT_SIZE;
-                return prefix + "  lw   " + reg_to_str(loperand) + ", " + std::to_string(up_from_s0) + "(s0)";
+                /* Arguments on the stack are right above the frame. */
+                auto up_from_sp = frame.size + (roperand - 8) * INT_SIZE;
+                return prefix + load_from_frame(frame, reg_to_str(loperand), up_from_sp);
             }
         }
         case INSTR_CALL:
-            /* Save caller-saved registers. */
-            return prefix + "  sw   ra, 16(s0)\n"
-                          + "  sw   t0, -4(s0)\n"
-                          + "  sw   t1, -8(s0)\n"
-                          + "  sw   t2, -12(s0)\n"
-                          + "  sw   t3, -16(s0)\n"
-                          + "  sw   t4, -20(s0)\n"
-                          + "  sw   t5, -24(s0)\n"
-                          + "  sw   t6, -28(s0)\n"
-                          + "  call " + global_addr_to_str(loperand) + "\n"
-                          + "  lw   t0, -4(s0)\n"
-                          + "  lw   t1, -8(s0)\n"
-                          + "  lw   t2, -12(s0)\n"
-                          + "  lw   t3, -16(s0)\n"
-                          + "  lw   t4, -20(s0)\n"
-                          + "  lw   t5, -24(s0)\n"
-                          + "  lw   t6, -28(s0)\n"
-                          + "  lw   ra, 16(s0)\n"
-                          + "  mv   " + reg_to_str(dest) + ", a0";
-        case INSTR_RET:
         {
-            std::string epilogue(prefix);
-            if (loperand > 0)
-                epilogue += "  mv   a0,  " + reg_to_str(loperand) + "\n";
-            if (all_subtracted < 2048)
-            {
-                epilogue += "  addi sp, sp, " + std::to_string((int)all_subtracted) + "\n";
-            }
-            else
+            /* Save caller-saved registers that are live across the call
+               and written by the callee. Register tX has its place at
+               4X bytes above the arguments on the stack. */
+            std::string saves, restores;
+            for (auto& reg: caller_saved)
             {
-                epilogue += "  li   s3, " + std::to_string((int)all_subtracted) + "\n"
-                          + "  add  sp, sp, s3\n";
+                auto offset = std::to_string((int)(frame.exceeding_args + INT_SIZE * (reg - 1)));
+                saves += "  sw   " + reg_to_str(reg) + ", " + offset + "(sp)\n";
+                restores += "\n  lw   " + reg_to_str(reg) + ", " + offset + "(sp)";
             }
-            /* Recover callee-saved registers. */
-            epilogue += std::string("  lw   s3, 12(s0)\n")
-                      + "  lw   s2, 8(s0)\n"
-                      + "  lw   s1, 4(s0)\n"
-                      + "  lw   s0, 0(s0)\n"
-                      + "  ret  ";
-            return epilogue;
+            std::string result;
+            if (dest != ARG_REGISTER(0))
+                result = "\n  mv   " + reg_to_str(dest) + ", a0";
+            return prefix + saves
+                          + "  call " + global_addr_to_str(loperand)
+                          + restores
+                          + result;
+        }
+        case INSTR_RET:
+        {
+            /* Returns after the prologue jump to the epilogue, which
+               follows the last instruction of the procedure. */
+            std::string ret(prefix);
+            if (loperand > 0 && loperand != ARG_REGISTER(0))
+                ret += "  mv   a0, " + reg_to_str(loperand) + "\n";
+            if (frame.framed_returns.count(code) == 0)
+                return ret + "  ret";
+            if (code == frame.last)
+                return ret;
+            return ret + "  j    " + frame.name + "_epilogue";
         }
         default:
             return prefix;
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <utility>
 #include "../parse/symbols.h"
 
 /************************************************************
@@ -57,7 +58,8 @@
 /**
  *  ALLOC dest, loperand
  *      Allocate a memory space of 'loperand' bytes to the address stored in
- *      'dest'.
+ *      'dest'. Before register allocation, the offset of the space within
+ *      the frame is stored in 'roperand'.
  */
 #define INSTR_ALLOC 4
 /**
@@ -136,6 +138,48 @@
  *      whose memory allocation is handled by operating system.
  */
 #define INSTR_GLOB 26
+/**
+ *  JGT  dest, loperand, roperand
+ *  JGEQ dest, loperand, roperand
+ *  JLT  dest, loperand, roperand
+ *  JLEQ dest, loperand, roperand
+ *  JEQ  dest, loperand, roperand
+ *  JNEQ dest, loperand, roperand
+ *      Compare the values stored in registers 'dest' and 'loperand', and jump
+ *      to the instruction with label 'roperand' if 'dest > loperand',
+ *      'dest >= loperand', and so on. Like RMMOV, these read 'dest'.
+ */
+#define INSTR_JGT 30
+#define INSTR_JGEQ 31
+#define INSTR_JLT 32
+#define INSTR_JLEQ 33
+#define INSTR_JEQ 34
+#define INSTR_JNEQ 35
+#define IS_COMPARE_JUMP(instr) ((instr) >= INSTR_JGT && (instr) <= INSTR_JNEQ)
+/**
+ *  PHI dest
+ *      Only in SSA form, at the beginning of a basic block. Move to register
+ *      'dest' the register that 'phi_args' pairs with the label of the
+ *      predecessor block control came from.
+ */
+#define INSTR_PHI 36
+/**
+ *  SLL dest, loperand, roperand
+ *  SRL dest, loperand, roperand
+ *  SRA dest, loperand, roperand
+ *      Shift the value stored in register 'loperand' left, right logically
+ *      or right arithmetically by the immediate 'roperand' (0 to 31), and
+ *      store the result to register 'dest'.
+ *  MULH dest, loperand, roperand
+ *      Store to register 'dest' the upper 32 bits of the signed 64-bit product
+ *      of the values stored in registers 'loperand' and 'roperand'.
+ *  These only come from strength reduction of multiplications, divisions
+ *  and remainders by constants.
+ */
+#define INSTR_SLL 37
+#define INSTR_SRL 38
+#define INSTR_SRA 39
+#define INSTR_MULH 40
 
 /************************************************************
  *    End definition of the intermediate representation.    *
@@ -151,6 +195,11 @@
 #define DEST_TEMP 8
 #define OPERAND_TEMP 9
 
+/* Argument registers a0-a7, which are also used for allocation. An argument
+   register holds an incoming argument until LARG reads it, is written by ARG,
+   and is clobbered by CALL, which returns its result in ARG_REGISTER(0). */
+#define ARG_REGISTER(i) (10 + (i))
+
 /**
  *  SAVE loperand
  *      Save the register DEST_TEMP to the relative address 'loperand', which
@@ -182,6 +231,8 @@ struct IntermediateCode
     std::size_t roperand;
     std::size_t dest;
     std::size_t instr;
+    /* Operands of a PHI, as (label of a predecessor block, register). */
+    std::vector<std::pair<std::size_t, std::size_t>> phi_args;
     IntermediateCode(std::size_t _instr, std::size_t _dest, std::size_t _loperand, std::size_t _roperand);
     IntermediateCode(std::size_t _instr, std::size_t _dest, std::size_t _loperand, std::size_t _roperand, std::vector<std::size_t>& _label);
     std::string to_str();
@@ -202,6 +253,7 @@ private:
     std::size_t generate_label();
     std::size_t generate_code_for_exp(Symbol* symbol);
     std::size_t generate_code_for_exp_as_rval(Symbol* symbol);
+    void generate_code_for_branch(Symbol* symbol, std::size_t label, bool jump_if);
     void generate_code_for_block_and_statement(Symbol* symbol);
 public:
     int error;
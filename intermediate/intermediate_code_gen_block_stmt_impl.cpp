@@ -87,13 +87,8 @@ void IntermediateCodeGenerator::generate_code_for_block_and_statement(Symbol* sy
             IfStatement* as_if = (IfStatement*)symbol;
             auto expr = as_if->children[0];
             auto stmt = as_if->children[1];
-            /* Generate code that evaluate the expression in 'expr_reg'. */
-            auto expr_reg = generate_code_for_exp_as_rval(expr);
-
-            auto if_not = generate_label(); /* Label to jump to if 'expr_reg == 0'. */
-            code.push_back(new IntermediateCode(
-                INSTR_JE, PLACEHOLDER, expr_reg, if_not, statement_label
-            ));
+            auto if_not = generate_label(); /* Label to jump to if 'expr' is false. */
+            generate_code_for_branch(expr, if_not, false);
             generate_code_for_block_and_statement(stmt);
             statement_label.push_back(if_not);
             return;
@@ -105,11 +100,8 @@ void IntermediateCodeGenerator::generate_code_for_block_and_statement(Symbol* sy
             auto stmt_if = as_if_else->children[1];
             auto stmt_else = as_if_else->children[2];
 
-            auto expr_reg = generate_code_for_exp_as_rval(expr);
             auto if_not = generate_label();
-            code.push_back(new IntermediateCode(
-                INSTR_JE, PLACEHOLDER, expr_reg, if_not, statement_label
-            ));
+            generate_code_for_branch(expr, if_not, false);
             generate_code_for_block_and_statement(stmt_if);
             auto end_if = generate_label();
             code.push_back(new IntermediateCode(
@@ -129,18 +121,19 @@ void IntermediateCodeGenerator::generate_code_for_block_and_statement(Symbol* sy
             auto break_label = label_if_break;
             auto continue_label = label_if_continue;
 
+            /* The loop is rotated: the condition is tested once before the
+               loop, and then at the bottom of every iteration, so that an
+               iteration takes a single jump back to the body. 'continue'
+               goes to the test at the bottom. */
             label_if_continue = generate_label();
-            statement_label.push_back(label_if_continue);
-
-            auto expr_reg = generate_code_for_exp_as_rval(expr);
             label_if_break = generate_label();
-            code.push_back(new IntermediateCode(
-                INSTR_JE, PLACEHOLDER, expr_reg, label_if_break, statement_label
-            ));
+            generate_code_for_branch(expr, label_if_break, false);
+
+            auto body = generate_label();
+            statement_label.push_back(body);
             generate_code_for_block_and_statement(stmt);
-            code.push_back(new IntermediateCode(
-                INSTR_JMP, PLACEHOLDER, PLACEHOLDER, label_if_continue, statement_label
-            ));
+            statement_label.push_back(label_if_continue);
+            generate_code_for_branch(expr, body, true);
             statement_label.push_back(label_if_break);
 
             /* Recover 'break' and 'continue' labels. */
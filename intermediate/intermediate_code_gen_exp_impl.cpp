@@ -68,6 +68,107 @@ std::size_t IntermediateCodeGenerator::generate_code_for_exp_as_rval(Symbol* sym
     }
 }
 
+/**
+ *  Generate code that jumps to 'label' if the value of 'symbol' is nonzero
+ *  (for 'jump_if == true') or zero (for 'jump_if == false'), and falls
+ *  through otherwise. Comparisons become a single compare-and-jump, and
+ *  '&&', '||' and '!' become control flow, so that no boolean value is
+ *  computed for a condition.
+ */
+void IntermediateCodeGenerator::generate_code_for_branch(Symbol* symbol, std::size_t label, bool jump_if)
+{
+    switch (symbol->symbol_idx)
+    {
+        case SYMBOL_AND:
+        {
+            AndExpression* as_and = (AndExpression*)symbol;
+            if (jump_if)
+            {
+                /* Jump only if both are true. */
+                auto if_false = generate_label();
+                generate_code_for_branch(as_and->children[0], if_false, false);
+                generate_code_for_branch(as_and->children[1], label, true);
+                statement_label.push_back(if_false);
+            }
+            else
+            {
+                generate_code_for_branch(as_and->children[0], label, false);
+                generate_code_for_branch(as_and->children[1], label, false);
+            }
+            return;
+        }
+        case SYMBOL_OR:
+        {
+            OrExpression* as_or = (OrExpression*)symbol;
+            if (jump_if)
+            {
+                generate_code_for_branch(as_or->children[0], label, true);
+                generate_code_for_branch(as_or->children[1], label, true);
+            }
+            else
+            {
+                /* Jump only if both are false. */
+                auto if_true = generate_label();
+                generate_code_for_branch(as_or->children[0], if_true, true);
+                generate_code_for_branch(as_or->children[1], label, false);
+                statement_label.push_back(if_true);
+            }
+            return;
+        }
+        case SYMBOL_UNARY:
+        {
+            UnaryExpression* as_unary = (UnaryExpression*)symbol;
+            if (as_unary->operation == UNARY_EXP_OPERATOR_NOT)
+            {
+                generate_code_for_branch(as_unary->children[0], label, !jump_if);
+                return;
+            }
+            break;
+        }
+        case SYMBOL_REL:
+        {
+            RelExpression* as_rel = (RelExpression*)symbol;
+            auto operand1 = generate_code_for_exp_as_rval(as_rel->children[0]);
+            auto operand2 = generate_code_for_exp_as_rval(as_rel->children[1]);
+            std::size_t instr;
+            switch (as_rel->operation)
+            {
+                case REL_EXP_OPERATOR_G:
+                    instr = jump_if ? INSTR_JGT : INSTR_JLEQ;
+                    break;
+                case REL_EXP_OPERATOR_GEQ:
+                    instr = jump_if ? INSTR_JGEQ : INSTR_JLT;
+                    break;
+                case REL_EXP_OPERATOR_L:
+                    instr = jump_if ? INSTR_JLT : INSTR_JGEQ;
+                    break;
+                default:
+                    instr = jump_if ? INSTR_JLEQ : INSTR_JGT;
+                    break;
+            }
+            code.push_back(new IntermediateCode(
+                instr, operand1, operand2, label, statement_label
+            ));
+            return;
+        }
+        case SYMBOL_EQ:
+        {
+            EqExpression* as_eq = (EqExpression*)symbol;
+            auto operand1 = generate_code_for_exp_as_rval(as_eq->children[0]);
+            auto operand2 = generate_code_for_exp_as_rval(as_eq->children[1]);
+            auto is_eq = (as_eq->operation == EQ_EXP_OPERATOR_EQ);
+            code.push_back(new IntermediateCode(
+                is_eq == jump_if ? INSTR_JEQ : INSTR_JNEQ, operand1, operand2, label, statement_label
+            ));
+            return;
+        }
+    }
+    auto var = generate_code_for_exp_as_rval(symbol);
+    code.push_back(new IntermediateCode(
+        jump_if ? INSTR_JNE : INSTR_JE, PLACEHOLDER, var, label, statement_label
+    ));
+}
+
 /**
  *  NOTICE: All registers must be assigned only ONCE!
  * 
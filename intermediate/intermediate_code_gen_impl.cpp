@@ -60,7 +60,8 @@ std::vector<IntermediateCode*> IntermediateCodeGenerator::simplify_code()
         auto code_line = code[i];
         if (code_line->instr == INSTR_JE ||
             code_line->instr == INSTR_JNE ||
-            code_line->instr == INSTR_JMP)
+            code_line->instr == INSTR_JMP ||
+            IS_COMPARE_JUMP(code_line->instr))
         {
             try
             {
@@ -117,7 +118,8 @@ std::vector<IntermediateCode*> IntermediateCodeGenerator::simplify_code()
                     {
                         if (code[l]->instr == INSTR_JE ||
                             code[l]->instr == INSTR_JNE ||
-                            code[l]->instr == INSTR_JMP)
+                            code[l]->instr == INSTR_JMP ||
+                            IS_COMPARE_JUMP(code[l]->instr))
                         {
                             code[l]->roperand = chosen_label;
                         }
@@ -126,6 +126,18 @@ std::string IntermediateCode::to_str()
             return prefix + "  je     " + addr_to_str(loperand) + ", " + label_to_str(roperand);
         case INSTR_JNE:
             return prefix + "  jne    " + addr_to_str(loperand) + ", " + label_to_str(roperand);
+        case INSTR_JGT:
+            return prefix + "  jgt    " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + label_to_str(roperand);
+        case INSTR_JGEQ:
+            return prefix + "  jgeq   " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + label_to_str(roperand);
+        case INSTR_JLT:
+            return prefix + "  jlt    " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + label_to_str(roperand);
+        case INSTR_JLEQ:
+            return prefix + "  jleq   " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + label_to_str(roperand);
+        case INSTR_JEQ:
+            return prefix + "  jeq    " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + label_to_str(roperand);
+        case INSTR_JNEQ:
+            return prefix + "  jneq   " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + label_to_str(roperand);
         case INSTR_ARG:
             return prefix + "  arg    " + arg_to_str(loperand) + ", " + addr_to_str(roperand);
         case INSTR_LARG:
@@ -136,6 +148,23 @@ std::string IntermediateCode::to_str()
             return prefix + "  ret    " + addr_to_str(loperand);
         case INSTR_GLOB:
             return prefix + "  glob   " + addr_to_str(loperand);
+        case INSTR_PHI:
+        {
+            auto str = prefix + "  phi    " + addr_to_str(dest);
+            for (auto& arg: phi_args)
+            {
+                str += ", [" + label_to_str(arg.first) + ": " + addr_to_str(arg.second) + "]";
+            }
+            return str;
+        }
+        case INSTR_SLL:
+            return prefix + "  sll    " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + std::to_string(roperand);
+        case INSTR_SRL:
+            return prefix + "  srl    " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + std::to_string(roperand);
+        case INSTR_SRA:
+            return prefix + "  sra    " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + std::to_string(roperand);
+        case INSTR_MULH:
+            return prefix + "  mulh   " + addr_to_str(dest) + ", " + addr_to_str(loperand) + ", " + addr_to_str(roperand);
         case INSTR_SAVE:
             return prefix + "  save   " + std::to_string((int)loperand) + "(%pframe), %8";
         case INSTR_LOADD:
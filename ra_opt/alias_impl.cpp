@@ -0,0 +1,189 @@
+#include "basicblock.h"
+#include <cstdint>
+
+static bool same_base(const MemoryBase& a, const MemoryBase& b)
+{
+    return a.kind == b.kind && a.id == b.id;
+}
+
+/* What following an address back finds: no single object, the object in
+   'base', or only a PHI already being followed, which adds no object. */
+enum { NO_BASE, FOUND_BASE, CYCLE };
+
+/**
+ *  Find the object that the address in register 'reg' points into, on the
+ *  SSA form of a procedure, by following copies, PHIs and additions of an
+ *  offset back to an ALLOC of the procedure, the IRMOV of a global address,
+ *  or the LARG of an array parameter. 'phis' keeps what every PHI followed
+ *  leads to, in the order 'followed', so that a pointer stepped around a
+ *  loop is found too.
+ */
+static int follow(std::size_t reg, const std::map<std::size_t, IntermediateCode*>& def_of,
+                  std::map<std::size_t, std::pair<int, MemoryBase>>& phis,
+                  std::vector<std::size_t>& followed, MemoryBase& base)
+{
+    auto it = def_of.find(reg);
+    if (it == def_of.end())
+        return NO_BASE;
+    auto code_line = it->second;
+    switch (code_line->instr)
+    {
+        case INSTR_ALLOC:
+            base = {INSTR_ALLOC, reg};
+            return FOUND_BASE;
+        case INSTR_IRMOV:
+            if (code_line->roperand != ADDR)
+                return NO_BASE;
+            base = {INSTR_IRMOV, code_line->loperand};
+            return FOUND_BASE;
+        case INSTR_LARG:
+            base = {INSTR_LARG, reg};
+            return FOUND_BASE;
+        case INSTR_RRMOV:
+        case INSTR_SUB:
+            return follow(code_line->loperand, def_of, phis, followed, base);
+        case INSTR_ADD:
+        {
+            /* The other operand is an offset, which leads to no object. */
+            MemoryBase l_base, r_base;
+            auto l = follow(code_line->loperand, def_of, phis, followed, l_base);
+            auto r = follow(code_line->roperand, def_of, phis, followed, r_base);
+            if (r == NO_BASE && l != NO_BASE)
+            {
+                base = l_base;
+                return l;
+            }
+            if (l == NO_BASE && r != NO_BASE)
+            {
+                base = r_base;
+                return r;
+            }
+            return NO_BASE;
+        }
+        case INSTR_PHI:
+        {
+            auto found = phis.find(reg);
+            if (found != phis.end())
+            {
+                base = found->second.second;
+                return found->second.first;
+            }
+            phis[reg] = {CYCLE, base};
+            followed.push_back(reg);
+            auto num_followed = followed.size();
+            int result = CYCLE;
+            for (auto& arg: code_line->phi_args)
+            {
+                MemoryBase arg_base;
+                auto arg_result = follow(arg.second, def_of, phis, followed, arg_base);
+                if (arg_result == NO_BASE ||
+                    (arg_result == FOUND_BASE && result == FOUND_BASE && !same_base(arg_base, base)))
+                {
+                    result = NO_BASE;
+                    break;
+                }
+                if (arg_result == FOUND_BASE)
+                {
+                    base = arg_base;
+                    result = FOUND_BASE;
+                }
+            }
+            /* What the PHIs followed from here found assumed this one had a
+               single object. */
+            if (result == NO_BASE)
+            {
+                while (followed.size() > num_followed)
+                {
+                    phis.erase(followed.back());
+                    followed.pop_back();
+                }
+            }
+            phis[reg] = {result, base};
+            return result;
+        }
+        default:
+            return NO_BASE;
+    }
+}
+
+/* Whether the address in register 'reg' points into a single object, which
+   is stored to 'base'. */
+bool address_base(std::size_t reg, const std::map<std::size_t, IntermediateCode*>& def_of, MemoryBase& base)
+{
+    std::map<std::size_t, std::pair<int, MemoryBase>> phis;
+    std::vector<std::size_t> followed;
+    return follow(reg, def_of, phis, followed, base) == FOUND_BASE;
+}
+
+/**
+ *  The register that the address in register 'reg' is a constant offset
+ *  from, following additions and subtractions of constants, and the offset,
+ *  which is stored to 'offset'.
+ */
+std::size_t address_offset(std::size_t reg, const std::map<std::size_t, IntermediateCode*>& def_of,
+                           std::int32_t& offset)
+{
+    auto constant_of = [&def_of](std::size_t reg, std::int32_t& value)
+    {
+        auto it = def_of.find(reg);
+        if (it == def_of.end() || it->second->instr != INSTR_IRMOV || it->second->roperand == ADDR)
+            return false;
+        value = (std::int32_t)it->second->loperand;
+        return true;
+    };
+    std::uint32_t sum = 0;
+    while (true)
+    {
+        auto it = def_of.find(reg);
+        if (it == def_of.end())
+            break;
+        auto code_line = it->second;
+        std::int32_t c;
+        if (code_line->instr == INSTR_ADD && constant_of(code_line->roperand, c))
+            reg = code_line->loperand;
+        else if (code_line->instr == INSTR_ADD && constant_of(code_line->loperand, c))
+            reg = code_line->roperand;
+        else if (code_line->instr == INSTR_SUB && constant_of(code_line->roperand, c))
+        {
+            reg = code_line->loperand;
+            c = (std::int32_t)(0u - (std::uint32_t)c);
+        }
+        else
+            break;
+        sum += (std::uint32_t)c;
+    }
+    offset = (std::int32_t)sum;
+    return reg;
+}
+
+/**
+ *  Whether the words at constant offsets from the addresses in two
+ *  registers may overlap. Words at different offsets from the same address
+ *  do not, and neither do objects of different ALLOCs or globals, and an
+ *  array parameter points into a global or a frame of a caller, never into
+ *  an ALLOC of the procedure itself.
+ */
+bool may_overlap(std::size_t a, std::int32_t a_offset, std::size_t b, std::int32_t b_offset,
+                 const std::map<std::size_t, IntermediateCode*>& def_of)
+{
+    if (a == b)
+    {
+        auto distance = (std::int64_t)a_offset - (std::int64_t)b_offset;
+        return distance > -INT_SIZE && distance < INT_SIZE;
+    }
+    MemoryBase x, y;
+    if (!address_base(a, def_of, x) || !address_base(b, def_of, y))
+        return true;
+    if (x.kind == INSTR_LARG || y.kind == INSTR_LARG)
+        return x.kind != INSTR_ALLOC && y.kind != INSTR_ALLOC;
+    return same_base(x, y);
+}
+
+/* Whether the words at the addresses in registers 'a' and 'b' may overlap. */
+bool may_alias(std::size_t a, std::size_t b, const std::map<std::size_t, IntermediateCode*>& def_of)
+{
+    std::int32_t a_offset, b_offset;
+    auto a_root = address_offset(a, def_of, a_offset);
+    auto b_root = address_offset(b, def_of, b_offset);
+    return may_overlap(a_root, a_offset, b_root, b_offset, def_of);
+}
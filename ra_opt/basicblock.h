@@ -5,12 +5,36 @@
 #include "../parse/symtab.h"
 #include <set>
 #include <map>
+#include <cstdint>
 
 extern SymbolTable* symbol_table;
 
+/* Register and label numbers not used by the program yet, for the passes
+   that create registers or labels. */
+struct NameSupply
+{
+    std::size_t next_register;
+    std::size_t next_label;
+    NameSupply(const std::vector<IntermediateCode*>& code);
+    std::size_t new_register();
+    std::size_t new_label();
+};
+
+/* Global variables, by address, that a procedure or the procedures it
+   calls may read or write, directly or through the addresses it passes to
+   calls. If 'unknown', it may read and write any of them. */
+struct MemoryEffects
+{
+    bool unknown;
+    std::set<std::size_t> read;
+    std::set<std::size_t> written;
+};
+
 struct Procedure
 {
     std::vector<IntermediateCode*> code;
+    /* Address of the function in the symbol table. */
+    std::size_t addr;
     Procedure(const std::vector<IntermediateCode*>& _code);
     void print_code();
     std::pair<std::size_t, std::size_t> register_range();
@@ -18,10 +42,38 @@ struct Procedure
     std::size_t max_call_args();
     std::size_t max_spilled_memory();
     std::size_t max_allocated_memory();
-    std::size_t stack_move_value();
+    void assign_alloc_offsets(const std::vector<std::set<std::size_t>>& global_liveness);
+    std::set<std::size_t> clobbered_registers(const std::map<std::size_t, std::set<std::size_t>>& clobbers);
+    void propagate_copies();
+    void layout_blocks(NameSupply& names);
+    void to_ssa(NameSupply& names);
+    void from_ssa(NameSupply& names);
+    void remove_unreachable_blocks();
+    void propagate_constants();
+    void number_values();
+    void eliminate_dead_code();
+    void reduce_strength(NameSupply& names);
+    void insert_preheaders(NameSupply& names);
+    void reduce_induction_variables(NameSupply& names);
+    void hoist_loop_invariants(NameSupply& names);
+    void optimize_memory_accesses();
+    MemoryEffects memory_effects(const std::map<std::size_t, MemoryEffects>& effects);
+    void promote_globals(NameSupply& names, const std::map<std::size_t, MemoryEffects>& effects);
+    void verify(const char* pass);
 };
 
 std::vector<Procedure*> make_procedures(const std::vector<IntermediateCode*>& code);
+std::vector<IntermediateCode*> merge_procedures(const std::vector<IntermediateCode*>& code,
+                                                const std::vector<Procedure*>& procs);
+
+/**** Interprocedural summaries ****/
+
+/* Whether a physical register may be overwritten by a call: t0-t6 and a0-a7. */
+bool is_caller_saved(std::size_t reg);
+std::vector<Procedure*> bottom_up_order(const std::vector<Procedure*>& procs);
+std::map<std::size_t, std::set<std::size_t>> clobber_summaries(const std::vector<Procedure*>& procs);
+std::map<std::size_t, MemoryEffects> memory_effect_summaries(const std::vector<Procedure*>& procs);
+void inline_procedures(const std::vector<Procedure*>& procs, NameSupply& names);
 
 struct BasicBlock
 {
@@ -34,9 +86,66 @@ struct BasicBlock
 };
 
 std::vector<BasicBlock*> make_basic_blocks(const std::vector<IntermediateCode*>& code);
+std::map<std::size_t, std::size_t> block_of_labels(const std::vector<BasicBlock*>& blocks);
+
+/**** Dominators ****/
+
+std::vector<std::size_t> immediate_dominators(const std::vector<BasicBlock*>& blocks);
+
+struct DominatorTree
+{
+    /* Immediate dominator of every block, 'idom.size()' if unreachable. */
+    std::vector<std::size_t> idom;
+    std::vector<std::vector<std::size_t>> children;
+    /* Preorder and postorder numbers of blocks in the tree. */
+    std::vector<std::size_t> pre;
+    std::vector<std::size_t> post;
+    DominatorTree(const std::vector<BasicBlock*>& blocks);
+    bool reachable(std::size_t b);
+    bool dominates(std::size_t a, std::size_t b);
+    std::size_t common_dominator(std::size_t a, std::size_t b);
+};
+
+/**** Loops ****/
+
+struct Loop
+{
+    std::size_t header;
+    std::set<std::size_t> body;
+    /* The only block entering the loop, if it has no other successor, and
+       'blocks.size()' otherwise. */
+    std::size_t preheader;
+};
+
+std::vector<Loop> find_loops(const std::vector<BasicBlock*>& blocks, DominatorTree& dom);
+
+/**** Memory accesses ****/
+
+/* An object in memory: the register written by an ALLOC ('kind' is
+   INSTR_ALLOC), a global address (INSTR_IRMOV), or the register holding an
+   array parameter (INSTR_LARG). */
+struct MemoryBase
+{
+    std::size_t kind;
+    std::size_t id;
+};
+
+bool address_base(std::size_t reg, const std::map<std::size_t, IntermediateCode*>& def_of, MemoryBase& base);
+std::size_t address_offset(std::size_t reg, const std::map<std::size_t, IntermediateCode*>& def_of,
+                           std::int32_t& offset);
+bool may_overlap(std::size_t a, std::int32_t a_offset, std::size_t b, std::int32_t b_offset,
+                 const std::map<std::size_t, IntermediateCode*>& def_of);
+bool may_alias(std::size_t a, std::size_t b, const std::map<std::size_t, IntermediateCode*>& def_of);
 
 /**** Helper class for Liveness Analysis ****/
 
+/* Registers read ('use') and written ('def') by an instruction. */
+std::set<std::size_t> use(IntermediateCode* code);
+std::set<std::size_t> def(IntermediateCode* code);
+/* The fields holding those registers, which passes rewrite to rename them. */
+std::vector<std::size_t*> use_fields(IntermediateCode* code);
+std::size_t* def_field(IntermediateCode* code);
+
 struct LivenessUpdater
 {
     std::vector<BasicBlock*> basic_blocks;
@@ -50,12 +159,28 @@ struct LivenessUpdater
 
 /**** Helper class for Register Allocation ****/
 
+/* The instruction (IRMOV or ALLOC) that recomputes a rematerializable register. */
+struct Rematerialization
+{
+    std::size_t instr;
+    std::size_t loperand;
+    std::size_t roperand;
+};
+
+std::map<std::size_t, Rematerialization> find_rematerializable(
+    const std::vector<IntermediateCode*>& code,
+    const std::vector<std::set<std::size_t>>& global_liveness,
+    std::size_t num_registers);
+
 struct AllocationTable
 {
-    /* 1-7 means t0-t6,  >(1 << 29) means memory */
+    /* 1-7 means t0-t6,  10-17 means a0-a7,  >(1 << 29) means memory */
     std::vector<std::size_t> allocation_table;
     std::size_t register_lower_range;
     std::set<std::size_t> free_registers;
+    /* Formal registers that are recomputed at every use, and never get a
+       physical register. */
+    std::set<std::size_t> rematerialized;
     AllocationTable(std::pair<std::size_t, std::size_t> _register_range);
     const std::size_t& operator[](std::size_t reg) const;
     std::size_t& operator[](std::size_t reg);
@@ -64,7 +189,25 @@ struct AllocationTable
 struct RegisterModifier
 {
     AllocationTable alloc_table;
+    /* Preferred physical register of a formal register: the argument register
+       it is passed in, or a0 if it is returned. */
+    std::map<std::size_t, std::size_t> hints;
+    /* Live range of every formal register, as [first point, last point]. */
+    std::map<std::size_t, std::pair<std::size_t, std::size_t>> live_range;
+    /* Instructions during which an argument register holds an argument that
+       is not yet read, by LARG or CALL. */
+    std::map<std::size_t, std::vector<std::pair<std::size_t, std::size_t>>> reserved;
+    /* Call instructions, and the caller-saved registers each may write, as a
+       bit mask. 'clobber_table[k][i]' is the union of the masks of calls 'i'
+       to 'i + 2^k - 1'. */
+    std::vector<std::size_t> calls;
+    std::vector<std::vector<std::size_t>> clobber_table;
     RegisterModifier(const AllocationTable& _alloc_table);
+    void prepare(const std::vector<IntermediateCode*>& _code,
+                 const std::vector<std::set<std::size_t>>& _global_liveness,
+                 const std::map<std::size_t, std::set<std::size_t>>& _clobbers);
+    std::size_t clobbered_during(std::size_t formal);
+    bool fits(std::size_t formal, std::size_t reg);
     void modify(IntermediateCode* _code, const std::set<std::size_t>& _before,
                 const std::set<std::size_t>& _after);
 };
@@ -74,15 +217,23 @@ struct RegisterAllocator
     RegisterModifier modifier;
     RegisterAllocator(const AllocationTable& _alloc_table);
     void allocate(const std::vector<IntermediateCode*>& _code, 
-                  const std::vector<std::set<std::size_t>>& _global_liveness);
+                  const std::vector<std::set<std::size_t>>& _global_liveness,
+                  const std::map<std::size_t, std::set<std::size_t>>& _clobbers);
 };
 
 struct MemorySpiller
 {
     std::size_t addr;
+    /* Maps a spilled register to its slot (relative address) in the frame. */
     std::map<std::size_t, std::size_t> memory_map;
+    /* Maps a spilled register to the last program point where it is live. */
+    std::map<std::size_t, std::size_t> live_until;
+    /* Maps a rematerialized register to the instruction recomputing it. */
+    std::map<std::size_t, Rematerialization> remat_map;
     MemorySpiller();
     std::size_t next_addr();
+    void assign_slots(const std::vector<IntermediateCode*>& code,
+                      const std::vector<std::set<std::size_t>>& global_liveness);
     void spill(std::vector<IntermediateCode*>& code);
 };
 
@@ -25,20 +25,25 @@ find_head_instr(const std::vector<IntermediateCode*>& code)
     /* 'index_dict' maps label number to line number. */
     for (std::size_t i = 0; i < length; i++)
     {
-        if (code[i]->labels.size() > 0)
+        for (auto& label: code[i]->labels)
         {
-            index_dict[code[i]->labels[0]] = i;
+            index_dict[label] = i;
         }
     }
     for (std::size_t i = 0; i < length; i++)
     {
         if (code[i]->instr == INSTR_JMP ||
             code[i]->instr == INSTR_JE ||
-            code[i]->instr == INSTR_JNE)
+            code[i]->instr == INSTR_JNE ||
+            IS_COMPARE_JUMP(code[i]->instr))
         {
             head_instr.push_back(index_dict.at(code[i]->roperand)); /* Find jump target. */
             head_instr.push_back(i + 1);
         }
+        else if (code[i]->instr == INSTR_RET)
+        {
+            head_instr.push_back(i + 1);
+        }
     }
     std::sort(head_instr.begin(), head_instr.end());
     auto new_end = std::unique(head_instr.begin(), head_instr.end());
@@ -82,11 +87,11 @@ find_succ(const std::vector<IntermediateCode*>& code)
         auto block = basic_blocks[i];
         if (i != num_blocks - 1) /* Not EXIT block */
         {
-            auto label = code[block.first]->labels;
-            if (label.size() > 0)
+            /* Use block number i to mark the instruction at the front
+               of block i. */
+            for (auto& label: code[block.first]->labels)
             {
-                index_dict[label[0]] = i; /* Use block number i to mark 
-                                    the instruction at the front of block i. */
+                index_dict[label] = i;
             }
         }
     }
@@ -99,7 +104,8 @@ find_succ(const std::vector<IntermediateCode*>& code)
         {
             auto last_instr = code[block.second - 1];
             if (last_instr->instr == INSTR_JE ||
-                last_instr->instr == INSTR_JNE)
+                last_instr->instr == INSTR_JNE ||
+                IS_COMPARE_JUMP(last_instr->instr))
             {
                 successors.push_back(index_dict[last_instr->roperand]);
                 successors.push_back(i + 1);
@@ -108,6 +114,10 @@ find_succ(const std::vector<IntermediateCode*>& code)
             {
                 successors.push_back(index_dict[last_instr->roperand]);
             }
+            else if (last_instr->instr == INSTR_RET)
+            {
+                successors.push_back(num_blocks - 1); /* EXIT block */
+            }
             else
             {
                 successors.push_back(i + 1);
@@ -154,6 +164,28 @@ std::vector<BasicBlock*> make_basic_blocks(const std::vector<IntermediateCode*>&
     return blocks;
 }
 
+/**
+ *  Map every label to the number of the block holding the instruction it
+ *  marks. Jump targets are always the first instruction of a block, but a
+ *  label may be left inside a block by a pass that removed the jump that
+ *  ended the block before it, and PHIs may still name it.
+ */
+std::map<std::size_t, std::size_t> block_of_labels(const std::vector<BasicBlock*>& blocks)
+{
+    std::map<std::size_t, std::size_t> block_of_label;
+    for (std::size_t b = 0; b < blocks.size(); b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            for (auto& label: code_line->labels)
+            {
+                block_of_label[label] = b;
+            }
+        }
+    }
+    return block_of_label;
+}
+
 BasicBlock::BasicBlock(const std::vector<IntermediateCode*>& _code, std::pair<std::size_t, std::size_t> _line_range)
 {
     code = _code;
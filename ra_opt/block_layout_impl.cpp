@@ -0,0 +1,363 @@
+#include "basicblock.h"
+#include <algorithm>
+
+/* The conditional jump that jumps exactly when 'instr' does not. */
+static std::size_t inverted_jump(std::size_t instr)
+{
+    switch (instr)
+    {
+        case INSTR_JE:
+            return INSTR_JNE;
+        case INSTR_JNE:
+            return INSTR_JE;
+        case INSTR_JGT:
+            return INSTR_JLEQ;
+        case INSTR_JGEQ:
+            return INSTR_JLT;
+        case INSTR_JLT:
+            return INSTR_JGEQ;
+        case INSTR_JLEQ:
+            return INSTR_JGT;
+        case INSTR_JEQ:
+            return INSTR_JNEQ;
+        default:
+            return INSTR_JEQ;
+    }
+}
+
+static bool is_conditional_jump(std::size_t instr)
+{
+    return instr == INSTR_JE || instr == INSTR_JNE || IS_COMPARE_JUMP(instr);
+}
+
+/**
+ *  Loop depth of every basic block. A loop is formed by the back edges to a
+ *  block that dominates their sources, and contains every block from which
+ *  such a source is reachable without going through the header.
+ */
+static std::vector<std::size_t> loop_depths(const std::vector<BasicBlock*>& blocks, DominatorTree& dom)
+{
+    auto num_blocks = blocks.size();
+    std::vector<std::size_t> depth(num_blocks, 0);
+    for (std::size_t header = 0; header < num_blocks; header++)
+    {
+        if (!dom.reachable(header))
+            continue;
+        std::vector<std::size_t> stack;
+        for (auto& p: blocks[header]->predecessors)
+        {
+            if (dom.reachable(p) && dom.dominates(header, p))
+                stack.push_back(p);
+        }
+        if (stack.size() == 0)
+            continue;
+        std::set<std::size_t> body = {header};
+        while (stack.size() > 0)
+        {
+            auto b = stack.back();
+            stack.pop_back();
+            if (!body.insert(b).second)
+                continue;
+            for (auto& p: blocks[b]->predecessors)
+            {
+                stack.push_back(p);
+            }
+        }
+        for (auto& b: body)
+        {
+            depth[b]++;
+        }
+    }
+    return depth;
+}
+
+/**
+ *  Redirect every jump to an instruction that only jumps on to the final
+ *  target of the chain of jumps.
+ */
+static void thread_jumps(std::vector<IntermediateCode*>& code)
+{
+    std::map<std::size_t, IntermediateCode*> at_label;
+    for (auto& code_line: code)
+    {
+        for (auto& label: code_line->labels)
+        {
+            at_label[label] = code_line;
+        }
+    }
+    for (auto& code_line: code)
+    {
+        if (code_line->instr != INSTR_JMP && !is_conditional_jump(code_line->instr))
+            continue;
+        std::set<std::size_t> seen;
+        auto target = code_line->roperand;
+        while (seen.insert(target).second)
+        {
+            auto it = at_label.find(target);
+            if (it == at_label.end() || it->second->instr != INSTR_JMP)
+                break;
+            target = it->second->roperand;
+        }
+        code_line->roperand = target;
+    }
+}
+
+/* An edge of the control flow graph, and its estimated frequency. */
+struct LayoutEdge
+{
+    std::size_t weight;
+    std::size_t from;
+    std::size_t to;
+    /* Whether 'to' follows 'from' in the original order. */
+    bool falls;
+};
+
+/**
+ *  Reorder the basic blocks of the procedure so that the likely successor of
+ *  a block follows it, and its jump becomes a fall-through. Labels the pass
+ *  needs are taken from 'names'.
+ *
+ *  Without a profile, edges are weighted by static heuristics: a block runs
+ *  8 times more often per loop it is in, a back edge is taken, an edge that
+ *  enters a loop is taken and one that leaves a loop is not, and an early
+ *  return is unlikely. Blocks are chained along the heaviest edges first,
+ *  except back edges, so that loops keep their test at the bottom. Ties keep
+ *  the original order. The chains are then placed from the entry, each after
+ *  the placed block that most likely jumps to it.
+ *
+ *  Finally, a jump to the next block is deleted, a conditional jump is
+ *  inverted if its target is next, and a jump is added where a block fell
+ *  through to a block that is no longer next. Jumps to jumps are threaded
+ *  first, and unreachable blocks are dropped.
+ */
+void Procedure::layout_blocks(NameSupply& names)
+{
+    thread_jumps(code);
+    auto blocks = make_basic_blocks(code);
+    /* The last block is the empty exit block, which stays last. */
+    auto num_blocks = blocks.size() - 1;
+    auto free_blocks = [&blocks]()
+    {
+        for (auto& b: blocks)
+        {
+            delete b;
+        }
+    };
+    if (num_blocks < 2)
+    {
+        free_blocks();
+        return;
+    }
+
+    auto block_of_label = block_of_labels(blocks);
+    /* The jump target of every block, and the block it falls through to, or
+       'num_blocks' if none. */
+    std::vector<std::size_t> target(num_blocks, num_blocks), fall(num_blocks, num_blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto last = blocks[b]->code.back();
+        if (last->instr == INSTR_JMP || is_conditional_jump(last->instr))
+            target[b] = block_of_label.at(last->roperand);
+        if (last->instr != INSTR_JMP && last->instr != INSTR_RET)
+            fall[b] = b + 1;
+    }
+    /* Code that falls off the end of the procedure must stay last. */
+    if (fall[num_blocks - 1] != num_blocks)
+    {
+        free_blocks();
+        return;
+    }
+
+    DominatorTree dom(blocks);
+    auto depth = loop_depths(blocks, dom);
+    auto is_back_edge = [&dom](std::size_t from, std::size_t to)
+    {
+        return dom.dominates(to, from);
+    };
+    auto is_return = [&blocks](std::size_t b)
+    {
+        return blocks[b]->code.back()->instr == INSTR_RET;
+    };
+
+    std::vector<LayoutEdge> edges;
+    std::size_t num_reachable = 0;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        if (!dom.reachable(b))
+            continue;
+        num_reachable++;
+        std::size_t frequency = 1;
+        for (std::size_t d = 0; d < depth[b] && d < 6; d++)
+        {
+            frequency *= 8;
+        }
+        if (target[b] == num_blocks || fall[b] == num_blocks)
+        {
+            auto succ = target[b] != num_blocks ? target[b] : fall[b];
+            if (succ != num_blocks)
+                edges.push_back({100 * frequency, b, succ, succ == fall[b]});
+            continue;
+        }
+        auto t = target[b], f = fall[b];
+        /* Percentage of the executions in which the jump is taken. */
+        std::size_t taken = 50;
+        if (is_back_edge(b, t) != is_back_edge(b, f))
+            taken = is_back_edge(b, t) ? 90 : 10;
+        else if ((depth[t] < depth[b]) != (depth[f] < depth[b]))
+            taken = depth[t] < depth[b] ? 10 : 90;
+        else if ((depth[t] > depth[b]) != (depth[f] > depth[b]))
+            taken = depth[t] > depth[b] ? 90 : 10;
+        else if (is_return(t) != is_return(f))
+            taken = is_return(t) ? 10 : 90;
+        edges.push_back({taken * frequency, b, t, false});
+        edges.push_back({(100 - taken) * frequency, b, f, true});
+    }
+    std::stable_sort(edges.begin(), edges.end(),
+                     [](const LayoutEdge& a, const LayoutEdge& b)
+                     {
+                         return a.weight > b.weight || (a.weight == b.weight && a.falls && !b.falls);
+                     });
+
+    /* Chain blocks along the heaviest edges. 'chain_of[b]' is the chain that
+       contains block 'b', and a chain is a list of blocks. */
+    std::vector<std::size_t> chain_of(num_blocks);
+    std::vector<std::vector<std::size_t>> chains(num_blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        chain_of[b] = b;
+        chains[b] = {b};
+    }
+    for (auto& edge: edges)
+    {
+        auto from = edge.from, to = edge.to;
+        auto& from_chain = chains[chain_of[from]];
+        auto& to_chain = chains[chain_of[to]];
+        if (to == 0 || is_back_edge(from, to) || chain_of[from] == chain_of[to] ||
+            from_chain.back() != from || to_chain.front() != to)
+            continue;
+        for (auto& b: to_chain)
+        {
+            chain_of[b] = chain_of[from];
+            from_chain.push_back(b);
+        }
+        to_chain.clear();
+    }
+
+    /* Place the chain of the entry block, and then repeatedly the chain most
+       likely jumped to from the placed blocks, or the first one if none is. */
+    std::vector<std::size_t> order;
+    std::vector<bool> placed(num_blocks, false);
+    auto place = [&](std::size_t chain)
+    {
+        for (auto& b: chains[chain])
+        {
+            order.push_back(b);
+            placed[b] = true;
+        }
+    };
+    place(chain_of[0]);
+    while (order.size() < num_reachable)
+    {
+        std::size_t best = num_blocks, best_weight = 0;
+        for (auto& edge: edges)
+        {
+            if (placed[edge.from] && !placed[edge.to] &&
+                chains[chain_of[edge.to]].front() == edge.to &&
+                (best == num_blocks || edge.weight > best_weight))
+            {
+                best = chain_of[edge.to];
+                best_weight = edge.weight;
+            }
+        }
+        if (best == num_blocks)
+        {
+            for (std::size_t b = 0; b < num_blocks; b++)
+            {
+                if (!placed[b] && dom.reachable(b))
+                {
+                    best = chain_of[b];
+                    break;
+                }
+            }
+        }
+        place(best);
+    }
+    auto num_placed = order.size();
+
+    /* Label of the first instruction of a block, created if it has none. */
+    auto label_of = [&](std::size_t b)
+    {
+        auto head = blocks[b]->code.front();
+        if (head->labels.size() == 0)
+            head->labels.push_back(names.new_label());
+        return head->labels.front();
+    };
+    /* Decide the jump at the end of every block before any instruction is
+       deleted, since that moves the labels of the deleted instruction. */
+    std::vector<std::size_t> jump_to(num_blocks, num_blocks);
+    for (std::size_t k = 0; k < num_placed; k++)
+    {
+        auto b = order[k];
+        auto next = k + 1 < num_placed ? order[k + 1] : num_blocks;
+        if (fall[b] != num_blocks && fall[b] != next)
+        {
+            auto last = blocks[b]->code.back();
+            if (target[b] == next)
+            {
+                /* Jump to the block fallen through to, and fall through to
+                   the target instead. */
+                last->instr = inverted_jump(last->instr);
+                last->roperand = label_of(fall[b]);
+                std::swap(target[b], fall[b]);
+            }
+            else
+            {
+                jump_to[b] = fall[b];
+                label_of(fall[b]);
+            }
+        }
+    }
+
+    std::vector<IntermediateCode*> laid_out;
+    laid_out.reserve(code.size() + num_placed);
+    std::vector<std::size_t> carried_labels;
+    for (std::size_t k = 0; k < num_placed; k++)
+    {
+        auto b = order[k];
+        auto next = k + 1 < num_placed ? order[k + 1] : num_blocks;
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (carried_labels.size() > 0)
+            {
+                code_line->labels.insert(code_line->labels.begin(),
+                                         carried_labels.begin(), carried_labels.end());
+                carried_labels.clear();
+            }
+            if (code_line == blocks[b]->code.back() &&
+                code_line->instr == INSTR_JMP && target[b] == next)
+            {
+                carried_labels.swap(code_line->labels);
+                delete code_line;
+                continue;
+            }
+            laid_out.push_back(code_line);
+        }
+        if (jump_to[b] != num_blocks)
+        {
+            laid_out.push_back(new IntermediateCode(
+                INSTR_JMP, PLACEHOLDER, PLACEHOLDER, label_of(jump_to[b])
+            ));
+        }
+    }
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        if (placed[b])
+            continue;
+        for (auto& code_line: blocks[b]->code)
+        {
+            delete code_line;
+        }
+    }
+    code.swap(laid_out);
+    free_blocks();
+}
@@ -0,0 +1,206 @@
+#include "basicblock.h"
+
+bool is_caller_saved(std::size_t reg)
+{
+    return (reg >= 1 && reg <= 7) ||
+           (reg >= ARG_REGISTER(0) && reg <= ARG_REGISTER(7));
+}
+
+static void visit(Procedure* proc,
+                  const std::map<std::size_t, Procedure*>& by_addr,
+                  std::set<Procedure*>& visited,
+                  std::vector<Procedure*>& order)
+{
+    visited.insert(proc);
+    for (auto& code_line: proc->code)
+    {
+        if (code_line->instr != INSTR_CALL)
+            continue;
+        auto it = by_addr.find(code_line->loperand);
+        if (it != by_addr.end() && visited.count(it->second) == 0)
+            visit(it->second, by_addr, visited, order);
+    }
+    order.push_back(proc);
+}
+
+/**
+ *  Order procedures so that every procedure comes after the procedures it
+ *  calls, except for calls within a cycle of the call graph (recursion).
+ */
+std::vector<Procedure*> bottom_up_order(const std::vector<Procedure*>& procs)
+{
+    std::map<std::size_t, Procedure*> by_addr;
+    for (auto& p: procs)
+    {
+        by_addr[p->addr] = p;
+    }
+    std::set<Procedure*> visited;
+    std::vector<Procedure*> order;
+    for (auto& p: procs)
+    {
+        if (visited.count(p) == 0)
+            visit(p, by_addr, visited, order);
+    }
+    return order;
+}
+
+/**
+ *  Caller-saved registers that the procedure may write, including those
+ *  written by the procedures it calls, after register allocation. 'clobbers'
+ *  maps the address of every procedure summarized so far to its result; a
+ *  call to any other function (a built-in one, or a recursive call) may
+ *  write every caller-saved register.
+ */
+std::set<std::size_t> Procedure::clobbered_registers(const std::map<std::size_t, std::set<std::size_t>>& clobbers)
+{
+    std::set<std::size_t> written;
+    for (auto& code_line: code)
+    {
+        switch (code_line->instr)
+        {
+            case INSTR_ARG:
+                if (code_line->loperand < 8)
+                    written.insert(ARG_REGISTER(code_line->loperand));
+                break;
+            case INSTR_CALL:
+            {
+                auto it = clobbers.find(code_line->loperand);
+                if (it == clobbers.end())
+                {
+                    for (std::size_t reg = 1; reg <= ARG_REGISTER(7); reg++)
+                    {
+                        if (is_caller_saved(reg))
+                            written.insert(reg);
+                    }
+                    return written;
+                }
+                written.insert(it->second.begin(), it->second.end());
+                written.insert(ARG_REGISTER(0));
+                break;
+            }
+            case INSTR_RET:
+                if (code_line->loperand != 0)
+                    written.insert(ARG_REGISTER(0));
+                break;
+            default:
+                break;
+        }
+        for (auto& reg: def(code_line))
+        {
+            if (is_caller_saved(reg))
+                written.insert(reg);
+        }
+    }
+    return written;
+}
+
+/**
+ *  Clobber summaries of all procedures after register allocation, by the
+ *  address of the procedure.
+ */
+std::map<std::size_t, std::set<std::size_t>> clobber_summaries(const std::vector<Procedure*>& procs)
+{
+    std::map<std::size_t, std::set<std::size_t>> clobbers;
+    for (auto& p: bottom_up_order(procs))
+    {
+        clobbers[p->addr] = p->clobbered_registers(clobbers);
+    }
+    return clobbers;
+}
+
+/**
+ *  Globals that the procedure may read and write, before SSA construction,
+ *  given the summaries 'effects' of procedures by address. The object of an
+ *  address is found through registers written once only. Built-in functions,
+ *  which have no summary, access only what they are passed.
+ */
+MemoryEffects Procedure::memory_effects(const std::map<std::size_t, MemoryEffects>& effects)
+{
+    std::map<std::size_t, IntermediateCode*> def_of;
+    std::set<std::size_t> written_again;
+    for (auto& code_line: code)
+    {
+        for (auto& reg: def(code_line))
+        {
+            if (!def_of.insert({reg, code_line}).second)
+                written_again.insert(reg);
+        }
+    }
+    for (auto& reg: written_again)
+    {
+        def_of.erase(reg);
+    }
+
+    MemoryEffects result;
+    result.unknown = false;
+    auto access = [&](std::size_t address, bool read, bool written)
+    {
+        MemoryBase base;
+        if (!address_base(address, def_of, base))
+        {
+            result.unknown = true;
+            return;
+        }
+        if (base.kind != INSTR_IRMOV)
+            return;
+        if (read)
+            result.read.insert(base.id);
+        if (written)
+            result.written.insert(base.id);
+    };
+    for (auto& code_line: code)
+    {
+        switch (code_line->instr)
+        {
+            case INSTR_MRMOV:
+                access(code_line->loperand, true, false);
+                break;
+            case INSTR_RMMOV:
+                access(code_line->dest, false, true);
+                break;
+            case INSTR_ARG:
+            {
+                /* Only addresses of globals, not values, are of interest. */
+                MemoryBase base;
+                if (address_base(code_line->roperand, def_of, base) && base.kind == INSTR_IRMOV)
+                {
+                    result.read.insert(base.id);
+                    result.written.insert(base.id);
+                }
+                break;
+            }
+            case INSTR_CALL:
+            {
+                auto it = effects.find(code_line->loperand);
+                if (it == effects.end())
+                    break;
+                result.unknown = result.unknown || it->second.unknown;
+                result.read.insert(it->second.read.begin(), it->second.read.end());
+                result.written.insert(it->second.written.begin(), it->second.written.end());
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return result;
+}
+
+/**
+ *  Memory effect summaries of all procedures, by the address of the
+ *  procedure. A call within a cycle of the call graph, to a procedure not
+ *  summarized yet, may access any global.
+ */
+std::map<std::size_t, MemoryEffects> memory_effect_summaries(const std::vector<Procedure*>& procs)
+{
+    std::map<std::size_t, MemoryEffects> effects;
+    for (auto& p: procs)
+    {
+        effects[p->addr].unknown = true;
+    }
+    for (auto& p: bottom_up_order(procs))
+    {
+        effects[p->addr] = p->memory_effects(effects);
+    }
+    return effects;
+}
@@ -0,0 +1,433 @@
+#include "basicblock.h"
+#include <cstdint>
+#include <algorithm>
+
+/* A value of the lattice of constant propagation: not yet known to have any
+   value, known to be the constant 'value', or known to vary. */
+struct LatticeValue
+{
+    enum { UNKNOWN, CONSTANT, VARYING } state;
+    int value;
+    bool operator!=(const LatticeValue& other) const
+    {
+        return state != other.state || (state == CONSTANT && value != other.value);
+    }
+};
+
+static bool is_conditional_jump(std::size_t instr)
+{
+    return instr == INSTR_JE || instr == INSTR_JNE || IS_COMPARE_JUMP(instr);
+}
+
+static LatticeValue meet(const LatticeValue& a, const LatticeValue& b)
+{
+    if (a.state == LatticeValue::UNKNOWN)
+        return b;
+    if (b.state == LatticeValue::UNKNOWN)
+        return a;
+    if (a.state == LatticeValue::CONSTANT && b.state == LatticeValue::CONSTANT && a.value == b.value)
+        return a;
+    return {LatticeValue::VARYING, 0};
+}
+
+/**
+ *  Fold a unary or binary operation, or a comparison of a compare-jump, on
+ *  constant operands, with the wrap-around arithmetic of RV32. Returns false
+ *  if it cannot be folded: a division by zero, or of INT_MIN by -1.
+ */
+static bool fold(std::size_t instr, int l, int r, int& result)
+{
+    auto wrap = [](std::int64_t value)
+    {
+        return (int)(std::uint32_t)value;
+    };
+    switch (instr)
+    {
+        case INSTR_RRMOV:
+            result = l;
+            return true;
+        case INSTR_NEG:
+            result = wrap(-(std::int64_t)l);
+            return true;
+        case INSTR_NOT:
+            result = (l == 0);
+            return true;
+        case INSTR_BOOL:
+            result = (l != 0);
+            return true;
+        case INSTR_ADD:
+            result = wrap((std::int64_t)l + r);
+            return true;
+        case INSTR_SUB:
+            result = wrap((std::int64_t)l - r);
+            return true;
+        case INSTR_MUL:
+            result = wrap((std::int64_t)l * r);
+            return true;
+        case INSTR_DIV:
+        case INSTR_MOD:
+            if (r == 0 || (l == INT32_MIN && r == -1))
+                return false;
+            result = (instr == INSTR_DIV) ? l / r : l % r;
+            return true;
+        case INSTR_GT:
+        case INSTR_JGT:
+            result = (l > r);
+            return true;
+        case INSTR_GEQ:
+        case INSTR_JGEQ:
+            result = (l >= r);
+            return true;
+        case INSTR_LT:
+        case INSTR_JLT:
+            result = (l < r);
+            return true;
+        case INSTR_LEQ:
+        case INSTR_JLEQ:
+            result = (l <= r);
+            return true;
+        case INSTR_EQ:
+        case INSTR_JEQ:
+            result = (l == r);
+            return true;
+        case INSTR_NEQ:
+        case INSTR_JNEQ:
+            result = (l != r);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ *  Sparse conditional constant propagation (Wegman and Zadeck) on the SSA
+ *  form of the procedure.
+ *
+ *  Every register starts as UNKNOWN, and only goes down the lattice to a
+ *  CONSTANT and then to VARYING. Starting from the entry, an instruction is
+ *  evaluated once its block is found executable, and again whenever one of
+ *  its operands changes. A PHI only meets the operands of executable edges,
+ *  and a conditional jump only makes executable the edges that its operands
+ *  allow, so constants are found through branches that are never taken. A
+ *  register without any write (an uninitialized variable) is VARYING.
+ *
+ *  Then every instruction computing a constant becomes an IRMOV of it, a
+ *  conditional jump with a known outcome becomes a JMP, or a JMP to the
+ *  block it fell through to, and blocks that are never executed are deleted
+ *  with the PHI operands coming from them. A block that is no longer the
+ *  target of any jump joins the block before it, and PHIs are rewritten to
+ *  match. The definitions that the folded instructions read are left to
+ *  dead code elimination.
+ */
+void Procedure::propagate_constants()
+{
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    auto block_of_label = block_of_labels(blocks);
+
+    std::map<std::size_t, LatticeValue> values;
+    std::map<IntermediateCode*, std::size_t> block_of;
+    std::map<std::size_t, std::vector<IntermediateCode*>> users;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            block_of[code_line] = b;
+            for (auto& reg: def(code_line))
+            {
+                values[reg] = {LatticeValue::UNKNOWN, 0};
+            }
+            for (auto& reg: use(code_line))
+            {
+                users[reg].push_back(code_line);
+            }
+        }
+    }
+    auto value_of = [&values](std::size_t reg)
+    {
+        auto it = values.find(reg);
+        return it == values.end() ? LatticeValue{LatticeValue::VARYING, 0} : it->second;
+    };
+
+    std::set<std::pair<std::size_t, std::size_t>> executable;
+    std::vector<bool> visited(num_blocks, false);
+    std::vector<std::pair<std::size_t, std::size_t>> flow_work;
+    std::vector<IntermediateCode*> ssa_work;
+    /* The outcome of every conditional jump: whether it may jump, and
+       whether it may fall through. */
+    std::map<IntermediateCode*, std::pair<bool, bool>> outcome;
+
+    auto set_value = [&](std::size_t reg, LatticeValue value)
+    {
+        if (value_of(reg) != value)
+        {
+            values[reg] = value;
+            auto it = users.find(reg);
+            if (it != users.end())
+                ssa_work.insert(ssa_work.end(), it->second.begin(), it->second.end());
+        }
+    };
+    auto evaluate = [&](IntermediateCode* code_line)
+    {
+        auto b = block_of.at(code_line);
+        if (code_line->instr == INSTR_PHI)
+        {
+            LatticeValue value = {LatticeValue::UNKNOWN, 0};
+            for (auto& arg: code_line->phi_args)
+            {
+                if (executable.count({block_of_label.at(arg.first), b}) > 0)
+                    value = meet(value, value_of(arg.second));
+            }
+            set_value(code_line->dest, value);
+            return;
+        }
+        if (is_conditional_jump(code_line->instr))
+        {
+            auto l = value_of(code_line->loperand);
+            auto r = IS_COMPARE_JUMP(code_line->instr) ? value_of(code_line->dest)
+                                                        : LatticeValue{LatticeValue::CONSTANT, 0};
+            if (l.state == LatticeValue::UNKNOWN || r.state == LatticeValue::UNKNOWN)
+                return;
+            bool jumps = true, falls = true;
+            if (l.state == LatticeValue::CONSTANT && r.state == LatticeValue::CONSTANT)
+            {
+                int taken;
+                if (code_line->instr == INSTR_JE)
+                    taken = (l.value == 0);
+                else if (code_line->instr == INSTR_JNE)
+                    taken = (l.value != 0);
+                else
+                    fold(code_line->instr, r.value, l.value, taken);
+                jumps = taken;
+                falls = !taken;
+            }
+            outcome[code_line] = {jumps, falls};
+            if (jumps)
+                flow_work.push_back({b, block_of_label.at(code_line->roperand)});
+            if (falls)
+                flow_work.push_back({b, b + 1});
+            return;
+        }
+        auto field = def_field(code_line);
+        if (field == nullptr)
+            return;
+        LatticeValue value = {LatticeValue::VARYING, 0};
+        switch (code_line->instr)
+        {
+            case INSTR_IRMOV:
+                if (code_line->roperand != ADDR)
+                    value = {LatticeValue::CONSTANT, (int)code_line->loperand};
+                break;
+            case INSTR_RRMOV:
+            case INSTR_NEG:
+            case INSTR_NOT:
+            case INSTR_BOOL:
+            case INSTR_ADD:
+            case INSTR_SUB:
+            case INSTR_MUL:
+            case INSTR_DIV:
+            case INSTR_MOD:
+            case INSTR_GT:
+            case INSTR_GEQ:
+            case INSTR_LT:
+            case INSTR_LEQ:
+            case INSTR_EQ:
+            case INSTR_NEQ:
+            {
+                auto operands = use_fields(code_line);
+                bool unknown = false, constant = true;
+                int l = 0, r = 0;
+                for (std::size_t k = 0; k < operands.size(); k++)
+                {
+                    auto operand = value_of(*operands[k]);
+                    unknown |= (operand.state == LatticeValue::UNKNOWN);
+                    constant &= (operand.state == LatticeValue::CONSTANT);
+                    (k == 0 ? l : r) = operand.value;
+                }
+                int result;
+                if (unknown)
+                    value = {LatticeValue::UNKNOWN, 0};
+                else if (constant && fold(code_line->instr, l, r, result))
+                    value = {LatticeValue::CONSTANT, result};
+                break;
+            }
+            default:
+                break;
+        }
+        set_value(*field, value);
+    };
+
+    flow_work.push_back({num_blocks, 0});
+    while (flow_work.size() > 0 || ssa_work.size() > 0)
+    {
+        if (flow_work.size() > 0)
+        {
+            auto edge = flow_work.back();
+            flow_work.pop_back();
+            if (!executable.insert(edge).second)
+                continue;
+            auto b = edge.second;
+            if (b >= num_blocks)
+                continue;
+            for (auto& code_line: blocks[b]->code)
+            {
+                if (code_line->instr == INSTR_PHI)
+                    evaluate(code_line);
+                else if (!visited[b])
+                    evaluate(code_line);
+            }
+            if (!visited[b])
+            {
+                visited[b] = true;
+                auto last = blocks[b]->code.back()->instr;
+                if (last == INSTR_JMP)
+                    flow_work.push_back({b, block_of_label.at(blocks[b]->code.back()->roperand)});
+                else if (last != INSTR_RET && !is_conditional_jump(last))
+                    flow_work.push_back({b, b + 1});
+            }
+            continue;
+        }
+        auto code_line = ssa_work.back();
+        ssa_work.pop_back();
+        if (visited[block_of.at(code_line)])
+            evaluate(code_line);
+    }
+
+    std::vector<IntermediateCode*> folded;
+    folded.reserve(code.size());
+    /* Labels of deleted PHIs, which go to the next instruction. */
+    std::vector<std::size_t> carried;
+    /* A label of the first instruction of every block, and the PHIs kept. */
+    std::vector<std::size_t> head_label(num_blocks, 0);
+    std::vector<std::vector<IntermediateCode*>> kept_phis(num_blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        if (blocks[b]->code.front()->labels.size() > 0)
+            head_label[b] = blocks[b]->code.front()->labels.front();
+        if (!visited[b])
+        {
+            for (auto& code_line: blocks[b]->code)
+            {
+                delete code_line;
+            }
+            continue;
+        }
+        /* Constant PHIs become IRMOVs after the remaining PHIs. */
+        std::vector<IntermediateCode*> constants;
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (code_line->instr == INSTR_PHI)
+            {
+                auto& args = code_line->phi_args;
+                std::vector<std::pair<std::size_t, std::size_t>> kept;
+                for (auto& arg: args)
+                {
+                    if (executable.count({block_of_label.at(arg.first), b}) > 0)
+                        kept.push_back(arg);
+                }
+                args.swap(kept);
+                auto value = value_of(code_line->dest);
+                if (value.state != LatticeValue::CONSTANT)
+                {
+                    code_line->labels.insert(code_line->labels.begin(), carried.begin(), carried.end());
+                    carried.clear();
+                    folded.push_back(code_line);
+                    kept_phis[b].push_back(code_line);
+                    continue;
+                }
+                carried.insert(carried.end(), code_line->labels.begin(), code_line->labels.end());
+                constants.push_back(new IntermediateCode(
+                    INSTR_IRMOV, code_line->dest, (std::size_t)value.value, PLACEHOLDER
+                ));
+                delete code_line;
+                continue;
+            }
+            for (auto& constant: constants)
+            {
+                constant->labels.swap(carried);
+                folded.push_back(constant);
+            }
+            constants.clear();
+            if (carried.size() > 0)
+            {
+                code_line->labels.insert(code_line->labels.begin(), carried.begin(), carried.end());
+                carried.clear();
+            }
+
+            auto it = outcome.find(code_line);
+            if (it != outcome.end() && it->second.first != it->second.second)
+            {
+                if (!it->second.first)
+                    code_line->roperand = blocks[b + 1]->code.front()->labels.front();
+                code_line->instr = INSTR_JMP;
+                code_line->loperand = code_line->dest = PLACEHOLDER;
+            }
+            auto field = def_field(code_line);
+            if (field != nullptr && code_line->instr != INSTR_IRMOV && code_line->instr != INSTR_PHI &&
+                value_of(*field).state == LatticeValue::CONSTANT)
+            {
+                code_line->loperand = (std::size_t)value_of(*field).value;
+                code_line->roperand = PLACEHOLDER;
+                code_line->instr = INSTR_IRMOV;
+            }
+            folded.push_back(code_line);
+        }
+    }
+
+    code.swap(folded);
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+
+    /* A block that a folded jump went to, and that no other jump goes to,
+       is now part of the block falling through to it: its PHIs, left with
+       the operand of that block only, become copies. The other PHIs keep an
+       operand for every edge left from a predecessor, named by the block
+       now holding it: a conditional jump to the block it fell through to
+       was two edges, and is one once folded. */
+    blocks = make_basic_blocks(code);
+    block_of_label = block_of_labels(blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        if (kept_phis[b].size() == 0)
+            continue;
+        auto joined = blocks[block_of_label.at(head_label[b])]->code.front();
+        if (std::find(joined->labels.begin(), joined->labels.end(), head_label[b]) != joined->labels.end())
+            continue;
+        for (auto& phi: kept_phis[b])
+        {
+            phi->instr = INSTR_RRMOV;
+            phi->loperand = phi->phi_args.front().second;
+            phi->roperand = PLACEHOLDER;
+            phi->phi_args.clear();
+        }
+    }
+    for (std::size_t b = 0; b + 1 < blocks.size(); b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (code_line->instr != INSTR_PHI)
+                break;
+            std::map<std::size_t, std::size_t> edges;
+            for (auto& pred: blocks[b]->predecessors)
+            {
+                edges[pred]++;
+            }
+            std::vector<std::pair<std::size_t, std::size_t>> kept;
+            for (auto& arg: code_line->phi_args)
+            {
+                auto pred = block_of_label.at(arg.first);
+                if (edges[pred] == 0)
+                    continue;
+                edges[pred]--;
+                kept.push_back({blocks[pred]->code.front()->labels.front(), arg.second});
+            }
+            code_line->phi_args.swap(kept);
+        }
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
@@ -0,0 +1,195 @@
+#include "basicblock.h"
+
+/**
+ *  Copies known to hold at a program point: the register copied by each
+ *  register written by a copy, and the other way around, so that a write
+ *  to a register finds the copies of it without looking at the others.
+ */
+struct CopySet
+{
+    std::map<std::size_t, std::size_t> source_of;
+    std::map<std::size_t, std::set<std::size_t>> copies_of;
+
+    void add(std::size_t dest, std::size_t source)
+    {
+        source_of[dest] = source;
+        copies_of[source].insert(dest);
+    }
+    void erase(std::size_t dest)
+    {
+        auto it = source_of.find(dest);
+        if (it == source_of.end())
+            return;
+        auto copies = copies_of.find(it->second);
+        copies->second.erase(dest);
+        if (copies->second.size() == 0)
+            copies_of.erase(copies);
+        source_of.erase(it);
+    }
+    /* Forget the copies that a write to 'reg' makes stale: the one written
+       to 'reg', and those of 'reg'. */
+    void kill(std::size_t reg)
+    {
+        erase(reg);
+        auto it = copies_of.find(reg);
+        if (it == copies_of.end())
+            return;
+        for (auto& dest: it->second)
+        {
+            source_of.erase(dest);
+        }
+        copies_of.erase(it);
+    }
+    void swap(CopySet& other)
+    {
+        source_of.swap(other.source_of);
+        copies_of.swap(other.copies_of);
+    }
+    bool operator!=(const CopySet& other) const
+    {
+        return source_of != other.source_of;
+    }
+};
+
+/**
+ *  Apply one instruction to the copies holding before it. If 'rewrite' is
+ *  set, its reads of copies are replaced by the copied registers first.
+ *  Sources of new copies are resolved the same way, so no chain of copies
+ *  is ever in the set.
+ */
+static void transfer(IntermediateCode* code_line, CopySet& copies, bool rewrite)
+{
+    if (rewrite)
+    {
+        for (auto& field: use_fields(code_line))
+        {
+            auto it = copies.source_of.find(*field);
+            if (it != copies.source_of.end())
+                *field = it->second;
+        }
+    }
+    for (auto& reg: def(code_line))
+    {
+        copies.kill(reg);
+    }
+    if (code_line->instr == INSTR_RRMOV && code_line->dest != code_line->loperand)
+    {
+        auto it = copies.source_of.find(code_line->loperand);
+        auto source = (it == copies.source_of.end()) ? code_line->loperand : it->second;
+        if (source != code_line->dest)
+            copies.add(code_line->dest, source);
+    }
+}
+
+/**
+ *  Copy propagation on the procedure, before SSA construction. A copy
+ *  'RRMOV d, s' reaches a read of 'd' if it is on every path to the read
+ *  with no write to 'd' or 's' after it, which is found by a forward data
+ *  flow analysis of the available copies. Such reads are replaced by reads
+ *  of 's', and the copies whose results are then no longer live are
+ *  deleted, as are moves from a register to itself.
+ *
+ *  This removes the copy made by every read of a local variable, each of
+ *  which would otherwise be a register of its own.
+ */
+void Procedure::propagate_copies()
+{
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+
+    /* Copies holding at the exit of every block, where blocks not reached
+       yet by the analysis hold every copy. */
+    std::vector<CopySet> out(num_blocks);
+    std::vector<bool> reached(num_blocks, false);
+    auto copies_in = [&](std::size_t b)
+    {
+        CopySet in;
+        bool first = true;
+        for (auto& p: blocks[b]->predecessors)
+        {
+            if (!reached[p])
+                continue;
+            if (first)
+            {
+                in = out[p];
+                first = false;
+                continue;
+            }
+            std::vector<std::size_t> stale;
+            for (auto& pair: in.source_of)
+            {
+                auto found = out[p].source_of.find(pair.first);
+                if (found == out[p].source_of.end() || found->second != pair.second)
+                    stale.push_back(pair.first);
+            }
+            for (auto& dest: stale)
+            {
+                in.erase(dest);
+            }
+        }
+        return in;
+    };
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (std::size_t b = 0; b < num_blocks; b++)
+        {
+            auto copies = (b == 0) ? CopySet() : copies_in(b);
+            for (auto& code_line: blocks[b]->code)
+            {
+                transfer(code_line, copies, false);
+            }
+            if (!reached[b] || copies != out[b])
+            {
+                reached[b] = true;
+                out[b].swap(copies);
+                changed = true;
+            }
+        }
+    }
+
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto copies = (b == 0) ? CopySet() : copies_in(b);
+        for (auto& code_line: blocks[b]->code)
+        {
+            transfer(code_line, copies, true);
+        }
+    }
+
+    LivenessUpdater updater(blocks);
+    updater.calculate_liveness();
+    std::vector<IntermediateCode*> kept;
+    kept.reserve(code.size());
+    std::vector<std::size_t> carried;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto& block_code = blocks[b]->code;
+        auto size = block_code.size();
+        for (std::size_t k = 0; k < size; k++)
+        {
+            auto code_line = block_code[k];
+            /* Liveness is stored from the exit of the block backwards. */
+            auto& live_after = updater.liveness[b][size - 1 - k];
+            if (code_line->instr == INSTR_RRMOV &&
+                (code_line->dest == code_line->loperand || live_after.count(code_line->dest) == 0))
+            {
+                carried.insert(carried.end(), code_line->labels.begin(), code_line->labels.end());
+                delete code_line;
+                continue;
+            }
+            if (carried.size() > 0)
+            {
+                code_line->labels.insert(code_line->labels.begin(), carried.begin(), carried.end());
+                carried.clear();
+            }
+            kept.push_back(code_line);
+        }
+    }
+    code.swap(kept);
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
@@ -0,0 +1,109 @@
+#include "basicblock.h"
+
+/* Whether an instruction must be kept even if nothing reads its result. */
+static bool has_side_effect(IntermediateCode* code)
+{
+    switch (code->instr)
+    {
+        case INSTR_RMMOV:
+        case INSTR_JMP:
+        case INSTR_JE:
+        case INSTR_JNE:
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
+        case INSTR_ARG:
+        case INSTR_CALL:
+        case INSTR_RET:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ *  Dead code elimination on the SSA form of the procedure, by mark and
+ *  sweep. Instructions with side effects (stores, jumps, arguments, calls
+ *  and returns) are live, and so is the instruction writing any register
+ *  that a live instruction reads. Everything else is deleted, including
+ *  PHIs and loads. Unreachable blocks are deleted first.
+ *
+ *  Since jumps are kept, so are the blocks. A block left without any
+ *  instruction other than PHIs gets a JMP to the block it fell through to,
+ *  which keeps the label PHIs name it by, until block layout deletes it.
+ */
+void Procedure::eliminate_dead_code()
+{
+    remove_unreachable_blocks();
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+
+    std::map<std::size_t, IntermediateCode*> def_of;
+    std::set<IntermediateCode*> live;
+    std::vector<IntermediateCode*> work;
+    for (auto& code_line: code)
+    {
+        for (auto& reg: def(code_line))
+        {
+            def_of[reg] = code_line;
+        }
+        if (has_side_effect(code_line))
+        {
+            live.insert(code_line);
+            work.push_back(code_line);
+        }
+    }
+    while (work.size() > 0)
+    {
+        auto code_line = work.back();
+        work.pop_back();
+        for (auto& reg: use(code_line))
+        {
+            auto it = def_of.find(reg);
+            if (it != def_of.end() && live.insert(it->second).second)
+                work.push_back(it->second);
+        }
+    }
+
+    std::vector<IntermediateCode*> swept;
+    swept.reserve(live.size() + num_blocks);
+    std::vector<std::size_t> carried;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto& block_code = blocks[b]->code;
+        /* Read the label of the next block before its head may be deleted. */
+        auto next_label = (b + 1 < num_blocks) ? blocks[b + 1]->code.front()->labels.front() : 0;
+        bool empty = true;
+        for (auto& code_line: block_code)
+        {
+            if (live.count(code_line) == 0)
+            {
+                carried.insert(carried.end(), code_line->labels.begin(), code_line->labels.end());
+                delete code_line;
+                continue;
+            }
+            if (carried.size() > 0)
+            {
+                code_line->labels.insert(code_line->labels.begin(), carried.begin(), carried.end());
+                carried.clear();
+            }
+            swept.push_back(code_line);
+            if (code_line->instr != INSTR_PHI)
+                empty = false;
+        }
+        if (empty)
+        {
+            swept.push_back(new IntermediateCode(
+                INSTR_JMP, PLACEHOLDER, PLACEHOLDER, next_label, carried
+            ));
+        }
+    }
+    code.swap(swept);
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
@@ -0,0 +1,135 @@
+#include "basicblock.h"
+
+/**
+ *  Immediate dominator of every basic block, by the iterative algorithm of
+ *  Cooper, Harvey and Kennedy. Block 0 is the entry, and is its own immediate
+ *  dominator. Blocks unreachable from the entry get 'blocks.size()'.
+ */
+std::vector<std::size_t> immediate_dominators(const std::vector<BasicBlock*>& blocks)
+{
+    auto num_blocks = blocks.size();
+    std::vector<std::size_t> idom(num_blocks, num_blocks);
+    if (num_blocks == 0)
+        return idom;
+
+    /* Number the reachable blocks in postorder. */
+    std::vector<std::size_t> postorder;
+    std::vector<std::size_t> post_num(num_blocks, num_blocks);
+    std::vector<bool> visited(num_blocks, false);
+    /* DFS stack of (block, index of the next successor to visit). */
+    std::vector<std::pair<std::size_t, std::size_t>> stack = {{0, 0}};
+    visited[0] = true;
+    while (stack.size() > 0)
+    {
+        auto& top = stack.back();
+        auto& succs = blocks[top.first]->successors;
+        if (top.second < succs.size())
+        {
+            auto next = succs[top.second++];
+            if (!visited[next])
+            {
+                visited[next] = true;
+                stack.push_back({next, 0});
+            }
+        }
+        else
+        {
+            post_num[top.first] = postorder.size();
+            postorder.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+
+    auto intersect = [&idom, &post_num](std::size_t a, std::size_t b)
+    {
+        while (a != b)
+        {
+            while (post_num[a] < post_num[b])
+                a = idom[a];
+            while (post_num[b] < post_num[a])
+                b = idom[b];
+        }
+        return a;
+    };
+
+    idom[0] = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        /* Visit blocks in reverse postorder, skipping the entry. */
+        for (auto it = postorder.rbegin() + 1; it != postorder.rend(); it++)
+        {
+            auto b = *it;
+            auto new_idom = num_blocks;
+            for (auto& p: blocks[b]->predecessors)
+            {
+                if (idom[p] == num_blocks)
+                    continue;
+                new_idom = (new_idom == num_blocks) ? p : intersect(p, new_idom);
+            }
+            if (idom[b] != new_idom)
+            {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+DominatorTree::DominatorTree(const std::vector<BasicBlock*>& blocks)
+{
+    idom = immediate_dominators(blocks);
+    auto num_blocks = blocks.size();
+    children = std::vector<std::vector<std::size_t>>(num_blocks);
+    for (std::size_t b = 1; b < num_blocks; b++)
+    {
+        if (idom[b] != num_blocks)
+            children[idom[b]].push_back(b);
+    }
+
+    /* Number the tree in preorder and postorder, so that dominance can be
+       tested in constant time. */
+    pre = std::vector<std::size_t>(num_blocks, num_blocks);
+    post = std::vector<std::size_t>(num_blocks, num_blocks);
+    if (num_blocks == 0)
+        return;
+    std::size_t pre_count = 0, post_count = 0;
+    std::vector<std::pair<std::size_t, std::size_t>> stack = {{0, 0}};
+    pre[0] = pre_count++;
+    while (stack.size() > 0)
+    {
+        auto& top = stack.back();
+        if (top.second < children[top.first].size())
+        {
+            auto next = children[top.first][top.second++];
+            pre[next] = pre_count++;
+            stack.push_back({next, 0});
+        }
+        else
+        {
+            post[top.first] = post_count++;
+            stack.pop_back();
+        }
+    }
+}
+
+bool DominatorTree::reachable(std::size_t b)
+{
+    return b < idom.size() && idom[b] != idom.size();
+}
+
+/* Whether block 'a' dominates block 'b'. Both must be reachable. */
+bool DominatorTree::dominates(std::size_t a, std::size_t b)
+{
+    return pre[a] <= pre[b] && post[b] <= post[a];
+}
+
+/* The nearest block that dominates both 'a' and 'b'. */
+std::size_t DominatorTree::common_dominator(std::size_t a, std::size_t b)
+{
+    while (!dominates(a, b))
+        a = idom[a];
+    return a;
+}
@@ -0,0 +1,249 @@
+#include "basicblock.h"
+#include <algorithm>
+
+/* Addresses of the global variables that are not arrays. */
+static std::set<std::size_t> global_scalars()
+{
+    std::set<std::size_t> scalars;
+    for (auto& entry: symbol_table->get_entries())
+    {
+        if (entry->type.basic_type == BASIC_TYPE_INT && entry->type.array_lengths.size() == 0)
+            scalars.insert(entry->addr);
+    }
+    return scalars;
+}
+
+/* Whether the code ends with a jump, after which control does not fall
+   through. */
+static bool is_jump(IntermediateCode* code)
+{
+    return code->instr == INSTR_JMP || code->instr == INSTR_JE || code->instr == INSTR_JNE ||
+           IS_COMPARE_JUMP(code->instr);
+}
+
+/**
+ *  Promote the global scalars accessed in the outermost loop where that is
+ *  possible to registers. Returns false if there is no such loop.
+ */
+static bool promote_in_loop(std::vector<IntermediateCode*>& code, NameSupply& names,
+                            const std::map<std::size_t, MemoryEffects>& effects,
+                            const std::set<std::size_t>& scalars)
+{
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    DominatorTree dom(blocks);
+    auto loops = find_loops(blocks, dom);
+
+    /* Registers holding the address of a global scalar. Before SSA form,
+       only those written once hold it everywhere. */
+    std::map<std::size_t, IntermediateCode*> def_of;
+    std::set<std::size_t> written_again;
+    for (auto& code_line: code)
+    {
+        for (auto& reg: def(code_line))
+        {
+            if (!def_of.insert({reg, code_line}).second)
+                written_again.insert(reg);
+        }
+    }
+    auto global_of = [&](std::size_t reg)
+    {
+        auto it = def_of.find(reg);
+        if (it == def_of.end() || written_again.count(reg) > 0 || it->second->instr != INSTR_IRMOV ||
+            it->second->roperand != ADDR || scalars.count(it->second->loperand) == 0)
+            return (std::size_t)0;
+        return it->second->loperand;
+    };
+
+    bool promoted = false;
+    /* Outermost first, as loops come innermost first. */
+    for (auto loop = loops.rbegin(); loop != loops.rend() && !promoted; ++loop)
+    {
+        if (loop->preheader == blocks.size())
+            continue;
+        auto& body = loop->body;
+        /* Globals accessed in the loop, whether they are written, and those
+           that cannot be promoted. */
+        std::map<std::size_t, bool> accessed;
+        std::set<std::size_t> excluded;
+        bool any_global = false;
+        for (auto& b: body)
+        {
+            for (auto& code_line: blocks[b]->code)
+            {
+                if (code_line->instr == INSTR_MRMOV && global_of(code_line->loperand) != 0)
+                {
+                    accessed.insert({global_of(code_line->loperand), false});
+                    continue;
+                }
+                if (code_line->instr == INSTR_RMMOV && global_of(code_line->dest) != 0)
+                {
+                    accessed[global_of(code_line->dest)] = true;
+                    if (global_of(code_line->loperand) != 0)
+                        excluded.insert(global_of(code_line->loperand));
+                    continue;
+                }
+                if (code_line->instr == INSTR_CALL)
+                {
+                    auto it = effects.find(code_line->loperand);
+                    if (it == effects.end())
+                        continue;
+                    if (it->second.unknown)
+                        any_global = true;
+                    excluded.insert(it->second.read.begin(), it->second.read.end());
+                    excluded.insert(it->second.written.begin(), it->second.written.end());
+                    continue;
+                }
+                /* Any other use of the address. */
+                for (auto& reg: use(code_line))
+                {
+                    if (global_of(reg) != 0)
+                        excluded.insert(global_of(reg));
+                }
+            }
+        }
+        if (any_global)
+            continue;
+        std::map<std::size_t, std::pair<std::size_t, bool>> promoted_globals;
+        for (auto& pair: accessed)
+        {
+            if (excluded.count(pair.first) == 0)
+                promoted_globals[pair.first] = {names.new_register(), pair.second};
+        }
+        if (promoted_globals.size() == 0)
+            continue;
+        promoted = true;
+
+        for (auto& b: body)
+        {
+            for (auto& code_line: blocks[b]->code)
+            {
+                if (code_line->instr == INSTR_MRMOV && promoted_globals.count(global_of(code_line->loperand)) > 0)
+                {
+                    code_line->instr = INSTR_RRMOV;
+                    code_line->loperand = promoted_globals.at(global_of(code_line->loperand)).first;
+                }
+                else if (code_line->instr == INSTR_RMMOV && promoted_globals.count(global_of(code_line->dest)) > 0)
+                {
+                    code_line->instr = INSTR_RRMOV;
+                    code_line->dest = promoted_globals.at(global_of(code_line->dest)).first;
+                }
+            }
+        }
+
+        /* Load before the loop. */
+        std::vector<IntermediateCode*> loads;
+        for (auto& pair: promoted_globals)
+        {
+            auto address = names.new_register();
+            loads.push_back(new IntermediateCode(INSTR_IRMOV, address, pair.first, ADDR));
+            loads.push_back(new IntermediateCode(INSTR_MRMOV, pair.second.first, address, PLACEHOLDER));
+        }
+        auto& preheader_code = blocks[loop->preheader]->code;
+        auto position = std::find(code.begin(), code.end(), preheader_code.back());
+        if (!is_jump(preheader_code.back()))
+            position++;
+        else if (preheader_code.size() == 1)
+            loads.front()->labels.swap(preheader_code.back()->labels);
+        code.insert(position, loads.begin(), loads.end());
+
+        /* Store on every edge leaving the loop, in a block of its own, which
+           is placed before the target if the loop falls through to it, and
+           at the end otherwise, and before every return in the loop. */
+        auto make_stores = [&]()
+        {
+            std::vector<IntermediateCode*> stores;
+            for (auto& pair: promoted_globals)
+            {
+                if (!pair.second.second)
+                    continue;
+                auto address = names.new_register();
+                stores.push_back(new IntermediateCode(INSTR_IRMOV, address, pair.first, ADDR));
+                stores.push_back(new IntermediateCode(INSTR_RMMOV, address, pair.second.first, PLACEHOLDER));
+            }
+            return stores;
+        };
+        bool any_written = false;
+        for (auto& pair: promoted_globals)
+        {
+            any_written = any_written || pair.second.second;
+        }
+        if (!any_written)
+            continue;
+        std::map<std::size_t, std::vector<std::size_t>> exits;
+        for (auto& b: body)
+        {
+            for (auto& s: blocks[b]->successors)
+            {
+                if (body.count(s) == 0)
+                    exits[s].push_back(b);
+            }
+        }
+        for (auto& exit: exits)
+        {
+            auto s = exit.first;
+            if (s == num_blocks)
+            {
+                for (auto& b: exit.second)
+                {
+                    auto stores = make_stores();
+                    auto ret = blocks[b]->code.back();
+                    if (blocks[b]->code.size() == 1)
+                        stores.front()->labels.swap(ret->labels);
+                    code.insert(std::find(code.begin(), code.end(), ret), stores.begin(), stores.end());
+                }
+                continue;
+            }
+            auto stores = make_stores();
+            auto target = blocks[s]->code.front();
+            if (target->labels.size() == 0)
+                target->labels.push_back(names.new_label());
+            auto& target_labels = target->labels;
+            auto label = names.new_label();
+            stores.push_back(new IntermediateCode(INSTR_JMP, PLACEHOLDER, PLACEHOLDER, target_labels.front()));
+            stores.front()->labels.push_back(label);
+            bool falls = false;
+            for (auto& b: exit.second)
+            {
+                auto last = blocks[b]->code.back();
+                if (is_jump(last) &&
+                    std::find(target_labels.begin(), target_labels.end(), last->roperand) != target_labels.end())
+                    last->roperand = label;
+                if (b + 1 == s && last->instr != INSTR_JMP && last->instr != INSTR_RET)
+                    falls = true;
+            }
+            if (falls)
+                code.insert(std::find(code.begin(), code.end(), target), stores.begin(), stores.end());
+            else
+                code.insert(code.end(), stores.begin(), stores.end());
+        }
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+    return promoted;
+}
+
+/**
+ *  Scalar promotion of global variables in loops, before SSA construction.
+ *
+ *  A global that is not an array is only accessed through the register
+ *  its address is moved to, so in a loop where no call may access it, by
+ *  the summaries 'effects', it can be kept in a new register: loaded once
+ *  in the preheader, and stored once on every edge leaving the loop if the
+ *  loop writes it. Its loads and stores in the loop become copies, which
+ *  copy propagation and SSA construction then remove.
+ *
+ *  The outermost loop where a global can be promoted is taken, and every
+ *  loop is then visited again, as the loop may be in another one.
+ */
+void Procedure::promote_globals(NameSupply& names, const std::map<std::size_t, MemoryEffects>& effects)
+{
+    auto scalars = global_scalars();
+    insert_preheaders(names);
+    while (promote_in_loop(code, names, effects, scalars))
+    {
+        insert_preheaders(names);
+    }
+}
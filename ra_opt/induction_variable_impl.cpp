@@ -0,0 +1,505 @@
+#include "basicblock.h"
+#include <cstdint>
+
+/* A basic induction variable: a PHI of the loop header that gets 'next',
+   its value plus the constant 'step', on every back edge. */
+struct BasicInduction
+{
+    IntermediateCode* phi;
+    std::size_t init;
+    IntermediateCode* next;
+    std::int32_t step;
+};
+
+/* A register that is 'scale * i + sum of factor * term', for a basic
+   induction variable 'i' and loop-invariant terms. */
+struct DerivedInduction
+{
+    std::size_t basic;
+    std::int32_t scale;
+    std::vector<std::pair<std::size_t, std::int32_t>> terms;
+};
+
+static std::int32_t wrap(std::int64_t value)
+{
+    return (std::int32_t)(std::uint32_t)value;
+}
+
+/**
+ *  Strength reduction of induction variables, and linear function test
+ *  replacement, on the SSA form of the procedure.
+ *
+ *  A basic induction variable 'i' of a loop is a PHI of its header that is
+ *  'i + c' on every back edge, for a constant 'c'. A derived induction
+ *  variable is computed in the loop from 'i' by multiplications or shifts
+ *  by constants, and additions or subtractions of loop-invariant registers,
+ *  so it is 'a * i + b' for a constant 'a' and a loop-invariant 'b'. Those
+ *  with 'a' other than 1 that are read by anything else than another such
+ *  computation, like the address of an array element, get a PHI of their
+ *  own, set to 'a * init + b' in the preheader and incremented by 'a * c'
+ *  right after 'i' is, and their computation is left to dead code
+ *  elimination. An array sweep is then one addition per element. Values
+ *  other than addresses are only reduced if 'a' is not a power of two, as a
+ *  shift costs no more than the addition, and the PHI takes a register.
+ *
+ *  If 'i' is then only read to compute 'i + c' and to test for the exit
+ *  of the loop, the test is replaced by one on such a variable, which also
+ *  leaves 'i' dead. This is only done where it cannot change the number of
+ *  iterations: the step is 1 or -1, the test is the only exit of the loop
+ *  and stops as 'i + c' reaches an invariant 'n', which the guard before the
+ *  loop, or the constants, show has not been reached at the entry. Then
+ *  'a * (i + c) + b' reaches 'a * n + b' exactly at the same time, and the
+ *  test is 'jneq'. The variable must be the address of an array access, so
+ *  that it does not wrap around before that, and the loop must make no call.
+ */
+void Procedure::reduce_induction_variables(NameSupply& names)
+{
+    insert_preheaders(names);
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    DominatorTree dom(blocks);
+    auto loops = find_loops(blocks, dom);
+
+    auto block_of_label = block_of_labels(blocks);
+    std::map<std::size_t, IntermediateCode*> def_of;
+    std::map<IntermediateCode*, std::size_t> block_of;
+    std::map<std::size_t, std::set<IntermediateCode*>> users;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            block_of[code_line] = b;
+            for (auto& reg: def(code_line))
+            {
+                def_of[reg] = code_line;
+            }
+            for (auto& reg: use(code_line))
+            {
+                users[reg].insert(code_line);
+            }
+        }
+    }
+    auto constant_of = [&def_of](std::size_t reg, std::int32_t& value)
+    {
+        auto it = def_of.find(reg);
+        if (it == def_of.end() || it->second->instr != INSTR_IRMOV || it->second->roperand == ADDR)
+            return false;
+        value = (std::int32_t)it->second->loperand;
+        return true;
+    };
+    auto same_value = [&](std::size_t a, std::size_t b)
+    {
+        std::int32_t x, y;
+        return a == b || (constant_of(a, x) && constant_of(b, y) && x == y);
+    };
+
+    /* New instructions, inserted before or after existing ones. */
+    std::map<IntermediateCode*, std::vector<IntermediateCode*>> inserted_before, inserted_after;
+    auto add = [&](std::vector<IntermediateCode*>& place, std::size_t b, IntermediateCode* code_line)
+    {
+        place.push_back(code_line);
+        block_of[code_line] = b;
+        for (auto& reg: def(code_line))
+        {
+            def_of[reg] = code_line;
+        }
+        for (auto& reg: use(code_line))
+        {
+            users[reg].insert(code_line);
+        }
+        return code_line->dest;
+    };
+
+    for (auto& loop: loops)
+    {
+        if (loop.preheader == blocks.size())
+            continue;
+        auto& body = loop.body;
+        auto header = loop.header, preheader = loop.preheader;
+        /* Code for the preheader goes before its jump, if it ends with one. */
+        auto preheader_last = blocks[preheader]->code.back();
+        auto& preheader_code = (preheader_last->instr == INSTR_JMP || preheader_last->instr == INSTR_JE ||
+                                preheader_last->instr == INSTR_JNE || IS_COMPARE_JUMP(preheader_last->instr)) ?
+                               inserted_before[preheader_last] : inserted_after[preheader_last];
+        auto in_loop = [&](std::size_t reg)
+        {
+            auto it = def_of.find(reg);
+            return it != def_of.end() && body.count(block_of.at(it->second)) > 0;
+        };
+        auto is_invariant = [&](std::size_t reg)
+        {
+            return !in_loop(reg) || def_of.at(reg)->instr == INSTR_IRMOV;
+        };
+        /* A register holding the invariant 'reg' in the preheader. */
+        auto in_preheader = [&](std::size_t reg)
+        {
+            if (!in_loop(reg))
+                return reg;
+            auto irmov = def_of.at(reg);
+            return add(preheader_code, preheader, new IntermediateCode(
+                INSTR_IRMOV, names.new_register(), irmov->loperand, irmov->roperand
+            ));
+        };
+        /* Compute 'scale * reg + terms' in the preheader. */
+        auto evaluate = [&](std::size_t reg, const DerivedInduction& derived)
+        {
+            auto value = reg;
+            if (derived.scale != 1)
+            {
+                auto scale = add(preheader_code, preheader, new IntermediateCode(
+                    INSTR_IRMOV, names.new_register(), (std::size_t)derived.scale, PLACEHOLDER
+                ));
+                value = add(preheader_code, preheader, new IntermediateCode(
+                    INSTR_MUL, names.new_register(), value, scale
+                ));
+            }
+            for (auto& term: derived.terms)
+            {
+                auto term_reg = in_preheader(term.first);
+                if (term.second != 1)
+                {
+                    auto factor = add(preheader_code, preheader, new IntermediateCode(
+                        INSTR_IRMOV, names.new_register(), (std::size_t)term.second, PLACEHOLDER
+                    ));
+                    term_reg = add(preheader_code, preheader, new IntermediateCode(
+                        INSTR_MUL, names.new_register(), term_reg, factor
+                    ));
+                }
+                value = add(preheader_code, preheader, new IntermediateCode(
+                    INSTR_ADD, names.new_register(), value, term_reg
+                ));
+            }
+            return value;
+        };
+
+        /* Find the basic induction variables. */
+        std::vector<BasicInduction> basics;
+        std::map<std::size_t, DerivedInduction> derived;
+        IntermediateCode* last_phi = nullptr;
+        for (auto& code_line: blocks[header]->code)
+        {
+            if (code_line->instr != INSTR_PHI)
+                break;
+            last_phi = code_line;
+            std::size_t init = 0, next = 0;
+            bool valid = true;
+            for (auto& arg: code_line->phi_args)
+            {
+                if (block_of_label.at(arg.first) == preheader)
+                    init = arg.second;
+                else if (next == 0 || next == arg.second)
+                    next = arg.second;
+                else
+                    valid = false;
+            }
+            if (!valid || init == 0 || next == 0 || !in_loop(next))
+                continue;
+            auto step = def_of.at(next);
+            std::int32_t c;
+            if (step->instr == INSTR_ADD && step->loperand == code_line->dest && constant_of(step->roperand, c))
+                basics.push_back({code_line, init, step, c});
+            else if (step->instr == INSTR_ADD && step->roperand == code_line->dest && constant_of(step->loperand, c))
+                basics.push_back({code_line, init, step, c});
+            else if (step->instr == INSTR_SUB && step->loperand == code_line->dest && constant_of(step->roperand, c))
+                basics.push_back({code_line, init, step, wrap(-(std::int64_t)c)});
+            else
+                continue;
+            derived[code_line->dest] = {basics.size() - 1, 1, {}};
+        }
+        if (basics.size() == 0)
+            continue;
+
+        /* Across calls, registers live through the loop are saved and
+           restored around every call, so no constant is loaded in the
+           preheader, and the limit of an exit test, which takes a register
+           that a constant 'n' does not, is not introduced. */
+        bool has_call = false;
+        for (auto& b: body)
+        {
+            for (auto& code_line: blocks[b]->code)
+            {
+                if (code_line->instr == INSTR_CALL)
+                    has_call = true;
+            }
+        }
+
+        /* Find the derived ones, until no more is found. */
+        std::vector<IntermediateCode*> computations;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto& b: body)
+            {
+                for (auto& code_line: blocks[b]->code)
+                {
+                    if (derived.count(code_line->dest) > 0 || def_field(code_line) == nullptr)
+                        continue;
+                    auto l = derived.find(code_line->loperand), r = derived.find(code_line->roperand);
+                    bool l_derived = (l != derived.end()), r_derived = (r != derived.end());
+                    DerivedInduction result;
+                    std::int32_t c;
+                    switch (code_line->instr)
+                    {
+                        case INSTR_MUL:
+                            if (l_derived && constant_of(code_line->roperand, c))
+                                result = l->second;
+                            else if (r_derived && constant_of(code_line->loperand, c))
+                                result = r->second;
+                            else
+                                continue;
+                            break;
+                        case INSTR_SLL:
+                            if (!l_derived)
+                                continue;
+                            result = l->second;
+                            c = wrap((std::int64_t)1 << code_line->roperand);
+                            break;
+                        case INSTR_ADD:
+                            if (l_derived && is_invariant(code_line->roperand))
+                            {
+                                result = l->second;
+                                result.terms.push_back({code_line->roperand, 1});
+                            }
+                            else if (r_derived && is_invariant(code_line->loperand))
+                            {
+                                result = r->second;
+                                result.terms.push_back({code_line->loperand, 1});
+                            }
+                            else
+                                continue;
+                            c = 1;
+                            break;
+                        case INSTR_SUB:
+                            if (l_derived && is_invariant(code_line->roperand))
+                            {
+                                result = l->second;
+                                result.terms.push_back({code_line->roperand, -1});
+                                c = 1;
+                            }
+                            else if (r_derived && is_invariant(code_line->loperand))
+                            {
+                                result = r->second;
+                                for (auto& term: result.terms)
+                                {
+                                    term.second = wrap(-(std::int64_t)term.second);
+                                }
+                                result.scale = wrap(-(std::int64_t)result.scale);
+                                result.terms.push_back({code_line->loperand, 1});
+                                c = 1;
+                            }
+                            else
+                                continue;
+                            break;
+                        default:
+                            continue;
+                    }
+                    result.scale = wrap((std::int64_t)result.scale * c);
+                    for (auto& term: result.terms)
+                    {
+                        term.second = wrap((std::int64_t)term.second * c);
+                    }
+                    derived[code_line->dest] = result;
+                    computations.push_back(code_line);
+                    changed = true;
+                }
+            }
+        }
+
+        /* Give a PHI to those read by anything else. */
+        std::set<IntermediateCode*> is_computation(computations.begin(), computations.end());
+        /* For every basic induction variable, the PHIs given to variables
+           derived from it that are addresses of array accesses, as the
+           derived variable and the register 'a * (i + c) + b'. */
+        std::map<std::size_t, std::vector<std::pair<DerivedInduction, std::size_t>>> addresses;
+        for (auto& computation: computations)
+        {
+            auto reg = computation->dest;
+            auto& var = derived.at(reg);
+            auto& basic = basics[var.basic];
+            bool read = false, address = false;
+            for (auto& user: users[reg])
+            {
+                if (is_computation.count(user) == 0)
+                    read = true;
+                if ((user->instr == INSTR_MRMOV && user->loperand == reg) ||
+                    (user->instr == INSTR_RMMOV && user->dest == reg))
+                    address = true;
+            }
+            /* Other values are reduced if they take more than a shift. */
+            auto magnitude = (var.scale < 0) ? 0u - (std::uint32_t)var.scale : (std::uint32_t)var.scale;
+            if (!read || var.scale == 1 || (!address && (magnitude & (magnitude - 1)) == 0))
+                continue;
+
+            auto start = evaluate(basic.init, var);
+            auto phi = new IntermediateCode(INSTR_PHI, names.new_register(), PLACEHOLDER, PLACEHOLDER);
+            auto next = names.new_register();
+            for (auto& arg: basic.phi->phi_args)
+            {
+                phi->phi_args.push_back({arg.first, arg.second == basic.init ? start : next});
+            }
+            add(inserted_after[last_phi], header, phi);
+            auto& step_code = inserted_after[basic.next];
+            auto step_block = block_of.at(basic.next);
+            auto increment = add(has_call ? step_code : preheader_code, has_call ? step_block : preheader,
+                                 new IntermediateCode(
+                INSTR_IRMOV, names.new_register(), (std::size_t)wrap((std::int64_t)var.scale * basic.step), PLACEHOLDER
+            ));
+            add(step_code, step_block, new IntermediateCode(INSTR_ADD, next, phi->dest, increment));
+            for (auto& user: users[reg])
+            {
+                if (is_computation.count(user) > 0)
+                    continue;
+                for (auto& field: use_fields(user))
+                {
+                    if (*field == reg)
+                        *field = phi->dest;
+                }
+                users[phi->dest].insert(user);
+            }
+            users[reg].clear();
+            if (address)
+                addresses[var.basic].push_back({var, next});
+        }
+
+        /* Replace exit tests. The only exit of the loop must be the test. */
+        std::vector<std::pair<std::size_t, std::size_t>> exits;
+        for (auto& b: body)
+        {
+            for (auto& s: blocks[b]->successors)
+            {
+                if (body.count(s) == 0)
+                    exits.push_back({b, s});
+            }
+        }
+        if (exits.size() != 1 || has_call)
+            continue;
+        auto test = blocks[exits.front().first]->code.back();
+        if (!IS_COMPARE_JUMP(test->instr) || block_of_label.at(test->roperand) != header)
+            continue;
+        /* Instructions of the loop left dead, such as the computations of
+           reduced variables and copies of 'i + c' nothing reads. */
+        std::vector<IntermediateCode*> pure;
+        for (auto& b: body)
+        {
+            for (auto& code_line: blocks[b]->code)
+            {
+                if (def_field(code_line) == &code_line->dest &&
+                    code_line->instr != INSTR_CALL && code_line->instr != INSTR_PHI)
+                    pure.push_back(code_line);
+            }
+        }
+        std::set<IntermediateCode*> dead;
+        changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto& code_line: pure)
+            {
+                if (dead.count(code_line) > 0)
+                    continue;
+                bool unread = true;
+                for (auto& user: users[code_line->dest])
+                {
+                    if (dead.count(user) == 0)
+                        unread = false;
+                }
+                if (unread)
+                {
+                    dead.insert(code_line);
+                    changed = true;
+                }
+            }
+        }
+        for (auto& pair: addresses)
+        {
+            auto& basic = basics[pair.first];
+            auto i = basic.phi->dest, next = basic.next->dest;
+            if (basic.step != 1 && basic.step != -1)
+                continue;
+            /* The test must go on while 'next < n' or 'next != n' (or
+               'next > n' for a step of -1), and nothing else may read 'i'. */
+            std::size_t n;
+            bool equality = (test->instr == INSTR_JNEQ);
+            if (test->dest == next && (equality || test->instr == (basic.step > 0 ? INSTR_JLT : INSTR_JGT)))
+                n = test->loperand;
+            else if (test->loperand == next && (equality || test->instr == (basic.step > 0 ? INSTR_JGT : INSTR_JLT)))
+                n = test->dest;
+            else
+                continue;
+            if (!is_invariant(n))
+                continue;
+            bool only_stepped = true;
+            for (auto& user: users[i])
+            {
+                if (user != basic.next && dead.count(user) == 0)
+                    only_stepped = false;
+            }
+            for (auto& user: users[next])
+            {
+                if (user != basic.phi && user != test && dead.count(user) == 0)
+                    only_stepped = false;
+            }
+            if (!only_stepped)
+                continue;
+            /* For '<' or '>', 'init < n' (or 'init > n') must hold at the
+               entry, by constants or by the guard before the preheader. */
+            if (!equality)
+            {
+                auto before = (basic.step > 0) ? INSTR_JLT : INSTR_JGT;
+                auto opposite = (basic.step > 0) ? INSTR_JGT : INSTR_JLT;
+                std::int32_t x, y;
+                bool guarded = false;
+                if (constant_of(basic.init, x) && constant_of(n, y))
+                    guarded = (basic.step > 0) ? x < y : x > y;
+                else if (blocks[preheader]->predecessors.size() == 1)
+                {
+                    auto guard_block = blocks[preheader]->predecessors.front();
+                    auto guard = blocks[guard_block]->code.back();
+                    bool jumps_in = IS_COMPARE_JUMP(guard->instr) &&
+                                    block_of_label.at(guard->roperand) == preheader;
+                    bool falls_in = IS_COMPARE_JUMP(guard->instr) && guard_block + 1 == preheader &&
+                                    block_of_label.at(guard->roperand) != preheader;
+                    /* Jumps in if 'init < n', or jumps away if 'init >= n'. */
+                    auto jump_in_if = [&](std::size_t instr, std::size_t x, std::size_t y)
+                    {
+                        return (guard->instr == instr && same_value(guard->dest, x) && same_value(guard->loperand, y));
+                    };
+                    auto away = (basic.step > 0) ? INSTR_JGEQ : INSTR_JLEQ;
+                    auto away_opposite = (basic.step > 0) ? INSTR_JLEQ : INSTR_JGEQ;
+                    guarded = (jumps_in && (jump_in_if(before, basic.init, n) || jump_in_if(opposite, n, basic.init))) ||
+                              (falls_in && (jump_in_if(away, basic.init, n) || jump_in_if(away_opposite, n, basic.init)));
+                }
+                if (!guarded)
+                    continue;
+            }
+            auto& var = pair.second.front();
+            auto limit = evaluate(in_preheader(n), var.first);
+            test->instr = INSTR_JNEQ;
+            test->dest = var.second;
+            test->loperand = limit;
+            break;
+        }
+    }
+
+    std::vector<IntermediateCode*> reduced;
+    reduced.reserve(code.size());
+    for (auto& code_line: code)
+    {
+        auto it = inserted_before.find(code_line);
+        if (it != inserted_before.end() && it->second.size() > 0)
+        {
+            it->second.front()->labels.swap(code_line->labels);
+            reduced.insert(reduced.end(), it->second.begin(), it->second.end());
+        }
+        reduced.push_back(code_line);
+        it = inserted_after.find(code_line);
+        if (it != inserted_after.end())
+            reduced.insert(reduced.end(), it->second.begin(), it->second.end());
+    }
+    code.swap(reduced);
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
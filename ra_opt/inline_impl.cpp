@@ -0,0 +1,198 @@
+#include "basicblock.h"
+
+/* Most instructions of a procedure inlined at its calls. */
+#define MAX_INLINE_SIZE 40
+/* Most instructions a procedure grows to by inlining. */
+#define MAX_PROCEDURE_SIZE 2000
+
+static void reach(std::size_t addr, const std::map<std::size_t, Procedure*>& by_addr,
+                  std::set<std::size_t>& reached)
+{
+    for (auto& code_line: by_addr.at(addr)->code)
+    {
+        if (code_line->instr != INSTR_CALL || by_addr.count(code_line->loperand) == 0)
+            continue;
+        if (reached.insert(code_line->loperand).second)
+            reach(code_line->loperand, by_addr, reached);
+    }
+}
+
+/* Whether a procedure may be inlined at its calls: it is small, calls
+   itself neither directly nor through other procedures, and its frame
+   holds no arrays. */
+static bool is_inlinable(Procedure* proc, const std::map<std::size_t, Procedure*>& by_addr)
+{
+    if (proc->code.size() > MAX_INLINE_SIZE)
+        return false;
+    for (auto& code_line: proc->code)
+    {
+        if (code_line->instr == INSTR_ALLOC)
+            return false;
+    }
+    std::set<std::size_t> reached;
+    reach(proc->addr, by_addr, reached);
+    return reached.count(proc->addr) == 0;
+}
+
+/**
+ *  Copy the code of 'callee' to 'code', in place of the call 'call', whose
+ *  arguments are passed by the ARG instructions 'args'. Registers and labels
+ *  of the callee are renamed to new ones, parameters are copied from the
+ *  arguments, and returns copy the value returned to the destination of the
+ *  call and jump to 'end', the label of the instruction after the call.
+ *  Returns whether any return jumps there.
+ */
+static bool inline_call(std::vector<IntermediateCode*>& code, IntermediateCode* call,
+                        const std::vector<IntermediateCode*>& args, Procedure* callee,
+                        std::size_t end, NameSupply& names)
+{
+    std::map<std::size_t, std::size_t> renamed;
+    auto rename = [&](std::size_t reg)
+    {
+        if (reg == 0)
+            return reg;
+        auto& name = renamed[reg];
+        if (name == 0)
+            name = names.new_register();
+        return name;
+    };
+    std::map<std::size_t, std::size_t> relabeled;
+    for (auto& code_line: callee->code)
+    {
+        for (auto& label: code_line->labels)
+        {
+            if (label != callee->addr)
+                relabeled[label] = names.new_label();
+        }
+    }
+
+    std::vector<IntermediateCode*> inlined;
+    for (std::size_t i = 0; i < callee->code.size(); i++)
+    {
+        auto code_line = callee->code[i];
+        /* Code after a return or a jump, with no label, is never run. */
+        if (i > 0 && code_line->labels.size() == 0 &&
+            (callee->code[i - 1]->instr == INSTR_RET || callee->code[i - 1]->instr == INSTR_JMP))
+            continue;
+        IntermediateCode* copy;
+        switch (code_line->instr)
+        {
+            case INSTR_LARG:
+                copy = new IntermediateCode(INSTR_RRMOV, rename(code_line->loperand),
+                                            args[code_line->roperand]->roperand, PLACEHOLDER);
+                inlined.push_back(copy);
+                break;
+            case INSTR_RET:
+                if (code_line->loperand != 0)
+                {
+                    copy = new IntermediateCode(INSTR_RRMOV, call->dest, rename(code_line->loperand), PLACEHOLDER);
+                    inlined.push_back(copy);
+                }
+                copy = new IntermediateCode(INSTR_JMP, PLACEHOLDER, PLACEHOLDER, end);
+                inlined.push_back(copy);
+                break;
+            default:
+                copy = new IntermediateCode(*code_line);
+                copy->labels.clear();
+                for (auto& field: use_fields(copy))
+                {
+                    *field = rename(*field);
+                }
+                if (def_field(copy) != nullptr)
+                    *def_field(copy) = rename(*def_field(copy));
+                if (copy->instr == INSTR_JMP || copy->instr == INSTR_JE || copy->instr == INSTR_JNE ||
+                    IS_COMPARE_JUMP(copy->instr))
+                    copy->roperand = relabeled.at(copy->roperand);
+                inlined.push_back(copy);
+                break;
+        }
+        /* The labels of a return go to its first instruction. */
+        auto first = inlined.end() - ((code_line->instr == INSTR_RET && code_line->loperand != 0) ? 2 : 1);
+        for (auto& label: code_line->labels)
+        {
+            if (label != callee->addr)
+                (*first)->labels.push_back(relabeled.at(label));
+        }
+    }
+    /* The last return falls through. */
+    if (inlined.size() > 1 && inlined.back()->labels.size() == 0)
+    {
+        delete inlined.back();
+        inlined.pop_back();
+    }
+
+    inlined.front()->labels.insert(inlined.front()->labels.begin(), call->labels.begin(), call->labels.end());
+    for (auto& arg: args)
+    {
+        inlined.front()->labels.insert(inlined.front()->labels.begin(), arg->labels.begin(), arg->labels.end());
+        delete arg;
+    }
+    delete call;
+    code.insert(code.end(), inlined.begin(), inlined.end());
+    for (auto& code_line: inlined)
+    {
+        if (code_line->instr == INSTR_JMP && code_line->roperand == end)
+            return true;
+    }
+    return false;
+}
+
+/**
+ *  Inline small procedures at their calls, before any other optimization,
+ *  so that the passes after it clean up the copies of parameters and
+ *  returned values, and fold constant arguments into the code inlined.
+ *
+ *  The cost of a procedure is its number of instructions. A call costs the
+ *  moves of its arguments, the saves of the registers live across it, and
+ *  the frame of the callee, which is more than a procedure of at most
+ *  MAX_INLINE_SIZE instructions usually does. Recursive procedures are not
+ *  inlined. Callers are visited after their callees, so that what is
+ *  inlined has its own calls inlined already, and stop growing at
+ *  MAX_PROCEDURE_SIZE instructions.
+ */
+void inline_procedures(const std::vector<Procedure*>& procs, NameSupply& names)
+{
+    std::map<std::size_t, Procedure*> by_addr;
+    for (auto& p: procs)
+    {
+        by_addr[p->addr] = p;
+    }
+    for (auto& p: bottom_up_order(procs))
+    {
+        std::vector<IntermediateCode*> code;
+        code.reserve(p->code.size());
+        auto& old_code = p->code;
+        for (std::size_t i = 0; i < old_code.size(); i++)
+        {
+            auto code_line = old_code[i];
+            code.push_back(code_line);
+            if (code_line->instr != INSTR_CALL || by_addr.count(code_line->loperand) == 0)
+                continue;
+            auto callee = by_addr.at(code_line->loperand);
+            auto num_args = code_line->roperand;
+            if (callee == p || !is_inlinable(callee, by_addr) || code.size() < num_args + 1 ||
+                code.size() + (old_code.size() - i) + callee->code.size() > MAX_PROCEDURE_SIZE)
+                continue;
+            /* The arguments are passed right before the call. */
+            std::vector<IntermediateCode*> args(code.end() - num_args - 1, code.end() - 1);
+            bool passed = true;
+            for (std::size_t k = 0; k < num_args; k++)
+            {
+                if (args[k]->instr != INSTR_ARG || args[k]->loperand != k)
+                    passed = false;
+            }
+            if (!passed)
+                continue;
+
+            /* The instruction after the call is labeled, for the returns. */
+            auto next = old_code[i + 1];
+            bool labeled = next->labels.size() == 0;
+            if (labeled)
+                next->labels.push_back(names.new_label());
+            code.erase(code.end() - num_args - 1, code.end());
+            if (!inline_call(code, code_line, args, callee, next->labels.front(), names) && labeled)
+                next->labels.clear();
+        }
+        old_code.swap(code);
+    }
+}
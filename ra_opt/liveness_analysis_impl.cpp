@@ -13,7 +13,7 @@ LivenessUpdater::LivenessUpdater(const std::vector<BasicBlock*>& _basic_blocks)
     }
 }
 
-static std::set<std::size_t> use(IntermediateCode* code)
+std::set<std::size_t> use(IntermediateCode* code)
 {
     switch (code->instr)
     {
@@ -55,12 +55,25 @@ static std::set<std::size_t> use(IntermediateCode* code)
             return std::set<std::size_t>({code->loperand, code->roperand});
         case INSTR_NEQ:
             return std::set<std::size_t>({code->loperand, code->roperand});
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
+            return std::set<std::size_t>({code->loperand});
+        case INSTR_MULH:
+            return std::set<std::size_t>({code->loperand, code->roperand});
         case INSTR_JMP:
             return std::set<std::size_t>();
         case INSTR_JE:
             return std::set<std::size_t>({code->loperand});
         case INSTR_JNE:
             return std::set<std::size_t>({code->loperand});
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
+            return std::set<std::size_t>({code->dest, code->loperand});
         case INSTR_ARG:
             return std::set<std::size_t>({code->roperand});
         case INSTR_LARG:
@@ -73,12 +86,21 @@ static std::set<std::size_t> use(IntermediateCode* code)
             return std::set<std::size_t>({code->loperand});
         case INSTR_GLOB:
             return std::set<std::size_t>();
+        case INSTR_PHI:
+        {
+            std::set<std::size_t> regs;
+            for (auto& arg: code->phi_args)
+            {
+                regs.insert(arg.second);
+            }
+            return regs;
+        }
         default:
             return std::set<std::size_t>();
     }
 }
 
-static std::set<std::size_t> def(IntermediateCode* code)
+std::set<std::size_t> def(IntermediateCode* code)
 {
     switch (code->instr)
     {
@@ -120,12 +142,24 @@ static std::set<std::size_t> def(IntermediateCode* code)
             return std::set<std::size_t>({code->dest});
         case INSTR_NEQ:
             return std::set<std::size_t>({code->dest});
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
+        case INSTR_MULH:
+            return std::set<std::size_t>({code->dest});
         case INSTR_JMP:
             return std::set<std::size_t>();
         case INSTR_JE:
             return std::set<std::size_t>();
         case INSTR_JNE:
             return std::set<std::size_t>();
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
+            return std::set<std::size_t>();
         case INSTR_ARG:
             return std::set<std::size_t>();
         case INSTR_LARG:
@@ -136,11 +170,106 @@ static std::set<std::size_t> def(IntermediateCode* code)
             return std::set<std::size_t>();
         case INSTR_GLOB:
             return std::set<std::size_t>();
+        case INSTR_PHI:
+            return std::set<std::size_t>({code->dest});
         default:
             return std::set<std::size_t>();
     }
 }
 
+/**
+ *  Fields of an instruction that hold registers it reads, and the field that
+ *  holds the register it writes (nullptr if none).
+ */
+std::vector<std::size_t*> use_fields(IntermediateCode* code)
+{
+    switch (code->instr)
+    {
+        case INSTR_RRMOV:
+        case INSTR_MRMOV:
+        case INSTR_NEG:
+        case INSTR_NOT:
+        case INSTR_BOOL:
+        case INSTR_JE:
+        case INSTR_JNE:
+        case INSTR_RET:
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
+            return {&code->loperand};
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        case INSTR_DIV:
+        case INSTR_MOD:
+        case INSTR_GT:
+        case INSTR_GEQ:
+        case INSTR_LT:
+        case INSTR_LEQ:
+        case INSTR_EQ:
+        case INSTR_NEQ:
+        case INSTR_MULH:
+            return {&code->loperand, &code->roperand};
+        case INSTR_RMMOV:
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
+            return {&code->loperand, &code->dest};
+        case INSTR_ARG:
+            return {&code->roperand};
+        case INSTR_PHI:
+        {
+            std::vector<std::size_t*> fields;
+            for (auto& arg: code->phi_args)
+            {
+                fields.push_back(&arg.second);
+            }
+            return fields;
+        }
+        default:
+            return {};
+    }
+}
+
+std::size_t* def_field(IntermediateCode* code)
+{
+    switch (code->instr)
+    {
+        case INSTR_IRMOV:
+        case INSTR_RRMOV:
+        case INSTR_MRMOV:
+        case INSTR_ALLOC:
+        case INSTR_NEG:
+        case INSTR_NOT:
+        case INSTR_BOOL:
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        case INSTR_DIV:
+        case INSTR_MOD:
+        case INSTR_GT:
+        case INSTR_GEQ:
+        case INSTR_LT:
+        case INSTR_LEQ:
+        case INSTR_EQ:
+        case INSTR_NEQ:
+        case INSTR_CALL:
+        case INSTR_PHI:
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
+        case INSTR_MULH:
+            return &code->dest;
+        case INSTR_LARG:
+            return &code->loperand;
+        default:
+            return nullptr;
+    }
+}
+
 std::vector<std::vector<std::set<std::size_t>>> LivenessUpdater::iterate_liveness()
 {
     auto length = basic_blocks.size();
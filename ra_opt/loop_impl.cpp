@@ -0,0 +1,163 @@
+#include "basicblock.h"
+#include <algorithm>
+
+/**
+ *  Natural loops of the procedure, one per header, innermost first. The
+ *  header of a loop is a block that dominates a predecessor, its back edge
+ *  source, and the loop is every block from which such a source is reached
+ *  without going through the header. Unreachable blocks are in no loop.
+ */
+std::vector<Loop> find_loops(const std::vector<BasicBlock*>& blocks, DominatorTree& dom)
+{
+    auto num_blocks = blocks.size();
+    std::vector<Loop> loops;
+    for (std::size_t header = 0; header < num_blocks; header++)
+    {
+        if (!dom.reachable(header))
+            continue;
+        std::vector<std::size_t> stack;
+        for (auto& p: blocks[header]->predecessors)
+        {
+            if (dom.reachable(p) && dom.dominates(header, p))
+                stack.push_back(p);
+        }
+        if (stack.size() == 0)
+            continue;
+        Loop loop;
+        loop.header = header;
+        loop.body = {header};
+        while (stack.size() > 0)
+        {
+            auto b = stack.back();
+            stack.pop_back();
+            if (!loop.body.insert(b).second)
+                continue;
+            for (auto& p: blocks[b]->predecessors)
+            {
+                if (dom.reachable(p))
+                    stack.push_back(p);
+            }
+        }
+        std::set<std::size_t> outside;
+        for (auto& p: blocks[header]->predecessors)
+        {
+            if (loop.body.count(p) == 0)
+                outside.insert(p);
+        }
+        loop.preheader = num_blocks;
+        if (outside.size() == 1)
+        {
+            auto p = *outside.begin();
+            auto& succs = blocks[p]->successors;
+            if (std::all_of(succs.begin(), succs.end(),
+                            [header](std::size_t s) { return s == header; }))
+                loop.preheader = p;
+        }
+        loops.push_back(loop);
+    }
+    /* A loop nested in another has fewer blocks. */
+    std::stable_sort(loops.begin(), loops.end(),
+                     [](const Loop& a, const Loop& b)
+                     {
+                         return a.body.size() < b.body.size();
+                     });
+    return loops;
+}
+
+/**
+ *  Give every loop of the procedure, which is in SSA form, a preheader: a
+ *  block whose only successor is the header, and which is the only
+ *  predecessor of the header outside the loop. Code that runs once before
+ *  the loop goes there.
+ *
+ *  A new preheader jumps to the header, and takes over the edges entering
+ *  the loop. If the header is entered from several blocks, the PHIs of the
+ *  header get their operands from those blocks through new PHIs of the
+ *  preheader. The preheader is placed before the header if a block entering
+ *  the loop falls through to it, and at the end of the procedure otherwise.
+ */
+void Procedure::insert_preheaders(NameSupply& names)
+{
+    auto blocks = make_basic_blocks(code);
+    DominatorTree dom(blocks);
+    auto loops = find_loops(blocks, dom);
+
+    auto block_of_label = block_of_labels(blocks);
+    /* New blocks, placed before the first instruction of a header, or at
+       the end. */
+    std::map<IntermediateCode*, std::vector<IntermediateCode*>> placed_before;
+    std::vector<IntermediateCode*> placed_last;
+    for (auto& loop: loops)
+    {
+        if (loop.preheader != blocks.size())
+            continue;
+        auto header = loop.header;
+        auto head = blocks[header]->code.front();
+        auto header_label = head->labels.front();
+        std::set<std::size_t> outside;
+        for (auto& p: blocks[header]->predecessors)
+        {
+            if (loop.body.count(p) == 0)
+                outside.insert(p);
+        }
+        auto label = names.new_label();
+        std::vector<IntermediateCode*> preheader;
+        for (auto& code_line: blocks[header]->code)
+        {
+            if (code_line->instr != INSTR_PHI)
+                break;
+            std::vector<std::pair<std::size_t, std::size_t>> kept, entering;
+            for (auto& arg: code_line->phi_args)
+            {
+                if (outside.count(block_of_label.at(arg.first)) > 0)
+                    entering.push_back(arg);
+                else
+                    kept.push_back(arg);
+            }
+            if (entering.size() == 1)
+                kept.push_back({label, entering.front().second});
+            else if (entering.size() > 1)
+            {
+                auto phi = new IntermediateCode(INSTR_PHI, names.new_register(), PLACEHOLDER, PLACEHOLDER);
+                phi->phi_args = entering;
+                preheader.push_back(phi);
+                kept.push_back({label, phi->dest});
+            }
+            code_line->phi_args.swap(kept);
+        }
+        preheader.push_back(new IntermediateCode(INSTR_JMP, PLACEHOLDER, PLACEHOLDER, header_label));
+        preheader.front()->labels.push_back(label);
+
+        bool falls = false;
+        for (auto& p: outside)
+        {
+            auto last = blocks[p]->code.back();
+            if ((last->instr == INSTR_JMP || last->instr == INSTR_JE || last->instr == INSTR_JNE ||
+                 IS_COMPARE_JUMP(last->instr)) && last->roperand == header_label)
+                last->roperand = label;
+            if (p + 1 == header && last->instr != INSTR_JMP && last->instr != INSTR_RET)
+                falls = true;
+        }
+        auto& place = falls ? placed_before[head] : placed_last;
+        place.insert(place.end(), preheader.begin(), preheader.end());
+    }
+
+    if (placed_before.size() > 0 || placed_last.size() > 0)
+    {
+        std::vector<IntermediateCode*> with_preheaders;
+        with_preheaders.reserve(code.size() + placed_last.size());
+        for (auto& code_line: code)
+        {
+            auto it = placed_before.find(code_line);
+            if (it != placed_before.end())
+                with_preheaders.insert(with_preheaders.end(), it->second.begin(), it->second.end());
+            with_preheaders.push_back(code_line);
+        }
+        with_preheaders.insert(with_preheaders.end(), placed_last.begin(), placed_last.end());
+        code.swap(with_preheaders);
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
@@ -0,0 +1,248 @@
+#include "basicblock.h"
+
+/* Most constants of a loop that are moved to its preheader, where each
+   takes a register through the loop. */
+#define MAX_LOOP_CONSTANTS 8
+
+/* Whether an instruction only computes its result from its operands. */
+static bool is_pure(IntermediateCode* code)
+{
+    switch (code->instr)
+    {
+        case INSTR_IRMOV:
+        case INSTR_RRMOV:
+        case INSTR_NEG:
+        case INSTR_NOT:
+        case INSTR_BOOL:
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        case INSTR_DIV:
+        case INSTR_MOD:
+        case INSTR_GT:
+        case INSTR_GEQ:
+        case INSTR_LT:
+        case INSTR_LEQ:
+        case INSTR_EQ:
+        case INSTR_NEQ:
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
+        case INSTR_MULH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ *  Loop-invariant code motion on the SSA form of the procedure. Loops are
+ *  given preheaders, and visited innermost first, so that what is moved to
+ *  the preheader of an inner loop, which is in the outer loop, can move on.
+ *
+ *  An instruction of a loop is invariant if it is pure, or a load, and
+ *  reads only registers written outside the loop or constants. It is moved,
+ *  with copies of the constants it reads, to the end of the preheader,
+ *  before its jump, and so is run once when the loop is entered, even if
+ *  the loop would not have run it: divisions, which are slow, and loads,
+ *  which may fault, are only moved if they are run every time the loop is,
+ *  that is if their block dominates every exit of the loop. A load is also only moved if no store of the loop may write the
+ *  object it reads. The constants left in the loop are moved too, unless
+ *  there are so many that they would not all stay in registers.
+ *
+ *  Loops that make calls are left alone: a register live through such a
+ *  loop is saved and restored around each call, which costs more than the
+ *  computations, usually of constants and addresses, that would be moved.
+ */
+void Procedure::hoist_loop_invariants(NameSupply& names)
+{
+    insert_preheaders(names);
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    DominatorTree dom(blocks);
+    auto loops = find_loops(blocks, dom);
+
+    std::vector<std::vector<IntermediateCode*>> block_code(num_blocks);
+    std::map<std::size_t, IntermediateCode*> def_of;
+    std::map<IntermediateCode*, std::size_t> block_of;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        block_code[b] = blocks[b]->code;
+        for (auto& code_line: block_code[b])
+        {
+            block_of[code_line] = b;
+            for (auto& reg: def(code_line))
+            {
+                def_of[reg] = code_line;
+            }
+        }
+    }
+
+    bool moved = false;
+    for (auto& loop: loops)
+    {
+        if (loop.preheader == blocks.size())
+            continue;
+        auto& body = loop.body;
+        bool has_call = false;
+        std::vector<std::size_t> stored;
+        std::vector<std::size_t> exits;
+        for (auto& b: body)
+        {
+            for (auto& code_line: block_code[b])
+            {
+                if (code_line->instr == INSTR_CALL)
+                    has_call = true;
+                else if (code_line->instr == INSTR_RMMOV)
+                    stored.push_back(code_line->dest);
+            }
+            for (auto& s: blocks[b]->successors)
+            {
+                if (body.count(s) == 0)
+                    exits.push_back(b);
+            }
+        }
+        if (has_call)
+            continue;
+
+        auto is_invariant = [&](std::size_t reg)
+        {
+            auto it = def_of.find(reg);
+            return it == def_of.end() || body.count(block_of.at(it->second)) == 0 ||
+                   it->second->instr == INSTR_IRMOV;
+        };
+        auto runs_every_time = [&](std::size_t b)
+        {
+            for (auto& e: exits)
+            {
+                if (!dom.dominates(b, e))
+                    return false;
+            }
+            return true;
+        };
+        auto& preheader_code = block_code[loop.preheader];
+        /* Move an instruction to the end of the preheader, before its jump. */
+        auto place = [&](IntermediateCode* code_line)
+        {
+            auto last = preheader_code.back();
+            auto position = preheader_code.end();
+            if (last->instr == INSTR_JMP || last->instr == INSTR_JE || last->instr == INSTR_JNE ||
+                IS_COMPARE_JUMP(last->instr))
+                position--;
+            if (position == preheader_code.begin())
+                code_line->labels.swap(last->labels);
+            preheader_code.insert(position, code_line);
+            block_of[code_line] = loop.preheader;
+            for (auto& reg: def(code_line))
+            {
+                def_of[reg] = code_line;
+            }
+        };
+        /* Copies in the preheader of the constants of the loop. */
+        std::map<std::size_t, std::size_t> constant_copy;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto& b: body)
+            {
+                auto& codes = block_code[b];
+                /* The last instruction stays, so the block is kept. */
+                for (std::size_t k = 0; k + 1 < codes.size(); k++)
+                {
+                    auto code_line = codes[k];
+                    bool is_load = (code_line->instr == INSTR_MRMOV);
+                    if ((!is_pure(code_line) && !is_load) || code_line->instr == INSTR_IRMOV)
+                        continue;
+                    bool invariant = true;
+                    for (auto& reg: use(code_line))
+                    {
+                        if (!is_invariant(reg))
+                            invariant = false;
+                    }
+                    if (!invariant)
+                        continue;
+                    if ((is_load || code_line->instr == INSTR_DIV || code_line->instr == INSTR_MOD) &&
+                        !runs_every_time(b))
+                        continue;
+                    if (is_load)
+                    {
+                        for (auto& address: stored)
+                        {
+                            if (may_alias(address, code_line->loperand, def_of))
+                                invariant = false;
+                        }
+                        if (!invariant)
+                            continue;
+                    }
+
+                    codes.erase(codes.begin() + k);
+                    if (k == 0)
+                        codes.front()->labels.swap(code_line->labels);
+                    k--;
+                    for (auto& field: use_fields(code_line))
+                    {
+                        auto it = def_of.find(*field);
+                        if (it == def_of.end() || body.count(block_of.at(it->second)) == 0)
+                            continue;
+                        auto irmov = it->second;
+                        auto& copy = constant_copy[*field];
+                        if (copy == 0)
+                        {
+                            copy = names.new_register();
+                            place(new IntermediateCode(INSTR_IRMOV, copy, irmov->loperand, irmov->roperand));
+                        }
+                        *field = copy;
+                    }
+                    place(code_line);
+                    changed = true;
+                    moved = true;
+                }
+            }
+        }
+
+        /* The constants left, if there are few values, as value numbering
+           then merges the copies of each. */
+        std::vector<std::pair<std::size_t, std::size_t>> constants;
+        std::set<std::pair<std::size_t, std::size_t>> values;
+        for (auto& b: body)
+        {
+            for (std::size_t k = 0; k + 1 < block_code[b].size(); k++)
+            {
+                auto code_line = block_code[b][k];
+                if (code_line->instr == INSTR_IRMOV)
+                {
+                    constants.push_back({b, k});
+                    values.insert({code_line->loperand, code_line->roperand});
+                }
+            }
+        }
+        if (constants.size() == 0 || values.size() > MAX_LOOP_CONSTANTS)
+            continue;
+        for (auto it = constants.rbegin(); it != constants.rend(); ++it)
+        {
+            auto& codes = block_code[it->first];
+            auto code_line = codes[it->second];
+            codes.erase(codes.begin() + it->second);
+            if (it->second == 0)
+                codes.front()->labels.swap(code_line->labels);
+            place(code_line);
+        }
+        moved = true;
+    }
+
+    if (moved)
+    {
+        std::vector<IntermediateCode*> hoisted;
+        hoisted.reserve(code.size());
+        for (auto& codes: block_code)
+        {
+            hoisted.insert(hoisted.end(), codes.begin(), codes.end());
+        }
+        code.swap(hoisted);
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
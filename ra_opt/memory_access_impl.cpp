@@ -0,0 +1,259 @@
+#include "basicblock.h"
+
+/* A word of memory, as a register and a constant offset from the address
+   in it. */
+typedef std::pair<std::size_t, std::int32_t> Location;
+/* Words whose values are known to be in registers at a program point. */
+typedef std::map<Location, std::size_t> MemoryState;
+
+static Location location_of(std::size_t address, const std::map<std::size_t, IntermediateCode*>& def_of)
+{
+    std::int32_t offset;
+    auto root = address_offset(address, def_of, offset);
+    return {root, offset};
+}
+
+/* Whether a word is in an object of an ALLOC whose address is not passed
+   to any call, which calls thus neither read nor write. */
+static bool is_private(const Location& location, const std::map<std::size_t, IntermediateCode*>& def_of,
+                       const std::set<std::size_t>& escaped)
+{
+    MemoryBase base;
+    return address_base(location.first, def_of, base) && base.kind == INSTR_ALLOC &&
+           escaped.count(base.id) == 0;
+}
+
+/**
+ *  Apply one instruction to the values known before it. If 'redundant' is
+ *  given, a load of a known value is rewritten into a copy of the register
+ *  holding it, and a store of the value already there is added to it.
+ */
+static void transfer(IntermediateCode* code_line, MemoryState& state,
+                     const std::map<std::size_t, IntermediateCode*>& def_of,
+                     const std::set<std::size_t>& escaped, std::set<IntermediateCode*>* redundant)
+{
+    Location location;
+    std::size_t value = 0;
+    switch (code_line->instr)
+    {
+        case INSTR_MRMOV:
+        {
+            location = location_of(code_line->loperand, def_of);
+            auto it = state.find(location);
+            if (it != state.end())
+            {
+                value = it->second;
+                if (redundant != nullptr)
+                {
+                    code_line->instr = INSTR_RRMOV;
+                    code_line->loperand = value;
+                }
+            }
+            else
+                value = code_line->dest;
+            break;
+        }
+        case INSTR_RMMOV:
+        {
+            location = location_of(code_line->dest, def_of);
+            value = code_line->loperand;
+            auto it = state.find(location);
+            if (it != state.end() && it->second == value)
+            {
+                if (redundant != nullptr)
+                    redundant->insert(code_line);
+                return;
+            }
+            for (auto it = state.begin(); it != state.end(); )
+            {
+                if (may_overlap(it->first.first, it->first.second, location.first, location.second, def_of))
+                    it = state.erase(it);
+                else
+                    ++it;
+            }
+            break;
+        }
+        case INSTR_CALL:
+            for (auto it = state.begin(); it != state.end(); )
+            {
+                if (!is_private(it->first, def_of, escaped))
+                    it = state.erase(it);
+                else
+                    ++it;
+            }
+            break;
+        default:
+            break;
+    }
+    /* A register written again, in the next iteration of a loop, no longer
+       holds the value or address it did. */
+    for (auto& reg: def(code_line))
+    {
+        for (auto it = state.begin(); it != state.end(); )
+        {
+            if (it->first.first == reg || it->second == reg)
+                it = state.erase(it);
+            else
+                ++it;
+        }
+    }
+    if (value != 0)
+        state[location] = value;
+}
+
+/**
+ *  Redundant load and dead store elimination on the SSA form of the
+ *  procedure, for arrays and globals alike.
+ *
+ *  A forward data flow analysis finds, at every point, the words of memory
+ *  whose values are in registers, because they were loaded or stored there
+ *  on every path to it. A load of such a word becomes a copy of the
+ *  register, which value numbering folds, so that a value stored is
+ *  forwarded to the loads after it, and a value loaded is reused. A store
+ *  of the value a word already holds is deleted. Words are told apart by
+ *  constant offsets from the same address, or by their objects: ALLOCs and
+ *  globals, and array parameters, which point into neither ALLOCs of the
+ *  procedure. A store forgets the words it may overlap, and a call all of
+ *  them except those of ALLOCs whose address is not passed to any call.
+ *
+ *  A store is also deleted if the same word is stored again later in its
+ *  block, with no load that may read it, and no call, in between.
+ */
+void Procedure::optimize_memory_accesses()
+{
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+
+    std::map<std::size_t, IntermediateCode*> def_of;
+    std::set<std::size_t> escaped;
+    for (auto& code_line: code)
+    {
+        for (auto& reg: def(code_line))
+        {
+            def_of[reg] = code_line;
+        }
+    }
+    for (auto& code_line: code)
+    {
+        MemoryBase base;
+        if (code_line->instr == INSTR_ARG && address_base(code_line->roperand, def_of, base) &&
+            base.kind == INSTR_ALLOC)
+            escaped.insert(base.id);
+    }
+
+    /* Values known at the exit of every block, where blocks not reached
+       yet by the analysis know every value. */
+    std::vector<MemoryState> out(num_blocks);
+    std::vector<bool> reached(num_blocks, false);
+    auto state_in = [&](std::size_t b)
+    {
+        MemoryState in;
+        bool first = true;
+        for (auto& p: blocks[b]->predecessors)
+        {
+            if (!reached[p])
+                continue;
+            if (first)
+            {
+                in = out[p];
+                first = false;
+                continue;
+            }
+            for (auto it = in.begin(); it != in.end(); )
+            {
+                auto found = out[p].find(it->first);
+                if (found == out[p].end() || found->second != it->second)
+                    it = in.erase(it);
+                else
+                    ++it;
+            }
+        }
+        return in;
+    };
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (std::size_t b = 0; b < num_blocks; b++)
+        {
+            auto state = (b == 0) ? MemoryState() : state_in(b);
+            for (auto& code_line: blocks[b]->code)
+            {
+                transfer(code_line, state, def_of, escaped, nullptr);
+            }
+            if (!reached[b] || state != out[b])
+            {
+                reached[b] = true;
+                out[b].swap(state);
+                changed = true;
+            }
+        }
+    }
+
+    std::set<IntermediateCode*> redundant;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto state = (b == 0) ? MemoryState() : state_in(b);
+        for (auto& code_line: blocks[b]->code)
+        {
+            transfer(code_line, state, def_of, escaped, &redundant);
+        }
+    }
+
+    /* Stores overwritten later in their blocks, found backwards. */
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        std::set<Location> overwritten;
+        auto& block_code = blocks[b]->code;
+        for (auto it = block_code.rbegin(); it != block_code.rend(); ++it)
+        {
+            auto code_line = *it;
+            if (code_line->instr == INSTR_RMMOV && redundant.count(code_line) == 0)
+            {
+                auto location = location_of(code_line->dest, def_of);
+                if (!overwritten.insert(location).second)
+                    redundant.insert(code_line);
+            }
+            else if (code_line->instr == INSTR_MRMOV)
+            {
+                auto location = location_of(code_line->loperand, def_of);
+                for (auto jt = overwritten.begin(); jt != overwritten.end(); )
+                {
+                    if (may_overlap(jt->first, jt->second, location.first, location.second, def_of))
+                        jt = overwritten.erase(jt);
+                    else
+                        ++jt;
+                }
+            }
+            else if (code_line->instr == INSTR_CALL)
+                overwritten.clear();
+        }
+    }
+
+    if (redundant.size() > 0)
+    {
+        std::vector<IntermediateCode*> kept;
+        kept.reserve(code.size());
+        std::vector<std::size_t> carried;
+        for (auto& code_line: code)
+        {
+            if (redundant.count(code_line) > 0)
+            {
+                carried.insert(carried.end(), code_line->labels.begin(), code_line->labels.end());
+                delete code_line;
+                continue;
+            }
+            if (carried.size() > 0)
+            {
+                code_line->labels.insert(code_line->labels.begin(), carried.begin(), carried.end());
+                carried.clear();
+            }
+            kept.push_back(code_line);
+        }
+        code.swap(kept);
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
@@ -3,6 +3,7 @@
 Procedure::Procedure(const std::vector<IntermediateCode*>& _code)
 {
     code = _code;
+    addr = 0;
 }
 
 static std::vector<IntermediateCode*>
@@ -53,6 +54,7 @@ std::vector<Procedure*> make_procedures(const std::vector<IntermediateCode*>& co
                 end++;
             }
             procs.push_back(new Procedure(make_code_weakcopy(code, {start, end})));
+            procs.back()->addr = symtab_entry->addr;
             start = end;
         }
     }
@@ -65,4 +67,76 @@ void Procedure::print_code()
     {
         printf("%s\n", code_line->to_str().c_str());
     }
-}
\ No newline at end of file
+}
+
+static bool is_function(std::size_t addr)
+{
+    for (auto& entry: symbol_table->get_entries())
+    {
+        if (entry->addr == addr && entry->type.basic_type == BASIC_TYPE_FUNC)
+            return true;
+    }
+    return false;
+}
+
+/**
+ *  Rebuild the code of the whole program from 'code', replacing the body
+ *  of every function by the code of the corresponding procedure in 'procs'.
+ *  The procedures must be in the order returned by 'make_procedures'.
+ */
+std::vector<IntermediateCode*> merge_procedures(const std::vector<IntermediateCode*>& code,
+                                                const std::vector<Procedure*>& procs)
+{
+    std::vector<IntermediateCode*> merged;
+    std::size_t proc_idx = 0;
+    for (auto& code_line: code)
+    {
+        if (code_line->instr != INSTR_GLOB)
+            continue;
+        merged.push_back(code_line);
+        if (is_function(code_line->loperand))
+        {
+            auto& proc_code = procs[proc_idx++]->code;
+            merged.insert(merged.end(), proc_code.begin(), proc_code.end());
+        }
+    }
+    return merged;
+}
+/**
+ *  Start numbering new registers and labels above every register and
+ *  statement label in 'code'. Memory-encoded registers (from 1 << 29) and
+ *  global labels (from 1 << 30) are not counted.
+ */
+NameSupply::NameSupply(const std::vector<IntermediateCode*>& code)
+{
+    next_register = 1;
+    next_label = 1;
+    for (auto& code_line: code)
+    {
+        for (auto& label: code_line->labels)
+        {
+            if (label < (1 << 30) && label >= next_label)
+                next_label = label + 1;
+        }
+        for (auto& reg: use(code_line))
+        {
+            if (reg < (1 << 29) && reg >= next_register)
+                next_register = reg + 1;
+        }
+        for (auto& reg: def(code_line))
+        {
+            if (reg < (1 << 29) && reg >= next_register)
+                next_register = reg + 1;
+        }
+    }
+}
+
+std::size_t NameSupply::new_register()
+{
+    return next_register++;
+}
+
+std::size_t NameSupply::new_label()
+{
+    return next_label++;
+}
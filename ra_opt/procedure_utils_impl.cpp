@@ -1,4 +1,5 @@
 #include "basicblock.h"
+#include <algorithm>
 
 std::pair<std::size_t, std::size_t> Procedure::register_range()
 {
@@ -233,6 +234,32 @@ std::pair<std::size_t, std::size_t> Procedure::register_range()
                 if (code_line->roperand > max_)
                     max_ = code_line->roperand;
                 break;
+            case INSTR_SLL:
+            case INSTR_SRL:
+            case INSTR_SRA:
+                if (code_line->dest < min_)
+                    min_ = code_line->dest;
+                if (code_line->dest > max_)
+                    max_ = code_line->dest;
+                if (code_line->loperand < min_)
+                    min_ = code_line->loperand;
+                if (code_line->loperand > max_)
+                    max_ = code_line->loperand;
+                break;
+            case INSTR_MULH:
+                if (code_line->dest < min_)
+                    min_ = code_line->dest;
+                if (code_line->dest > max_)
+                    max_ = code_line->dest;
+                if (code_line->loperand < min_)
+                    min_ = code_line->loperand;
+                if (code_line->loperand > max_)
+                    max_ = code_line->loperand;
+                if (code_line->roperand < min_)
+                    min_ = code_line->roperand;
+                if (code_line->roperand > max_)
+                    max_ = code_line->roperand;
+                break;
             case INSTR_JMP:
                 break;
             case INSTR_JE:
@@ -247,6 +274,21 @@ std::pair<std::size_t, std::size_t> Procedure::register_range()
                 if (code_line->loperand > max_)
                     max_ = code_line->loperand;
                 break;
+            case INSTR_JGT:
+            case INSTR_JGEQ:
+            case INSTR_JLT:
+            case INSTR_JLEQ:
+            case INSTR_JEQ:
+            case INSTR_JNEQ:
+                if (code_line->dest < min_)
+                    min_ = code_line->dest;
+                if (code_line->dest > max_)
+                    max_ = code_line->dest;
+                if (code_line->loperand < min_)
+                    min_ = code_line->loperand;
+                if (code_line->loperand > max_)
+                    max_ = code_line->loperand;
+                break;
             case INSTR_ARG:
                 if (code_line->roperand < min_)
                     min_ = code_line->roperand;
@@ -307,14 +349,15 @@ std::size_t Procedure::max_call_args()
 
 std::size_t Procedure::max_spilled_memory()
 {
-    std::size_t memory_min = (1 << 30), memory_max = 0;
+    /* Spill slots are relative addresses counted from 0 in every procedure. */
+    bool has_spill = false;
+    std::size_t memory_max = 0;
     for (auto& code_line: code)
     {
         if (code_line->instr == INSTR_SAVE)
         {
             auto rel_addr = code_line->loperand;
-            if (rel_addr < memory_min)
-                memory_min = rel_addr;
+            has_spill = true;
             if (rel_addr > memory_max)
                 memory_max = rel_addr;
         }
@@ -322,14 +365,13 @@ std::size_t Procedure::max_spilled_memory()
                  code_line->instr == INSTR_LOADO)
         {
             auto rel_addr = code_line->roperand;
-            if (rel_addr < memory_min)
-                memory_min = rel_addr;
+            has_spill = true;
             if (rel_addr > memory_max)
                 memory_max = rel_addr;
         }
     }
-    if (memory_max >= memory_min)
-        return memory_max - memory_min + INT_SIZE;
+    if (has_spill)
+        return memory_max + INT_SIZE;
     else
         return 0;
 }
@@ -339,68 +381,119 @@ std::size_t Procedure::max_allocated_memory()
     std::size_t memory = 0;
     for (auto& code_line: code)
     {
-        if (code_line->instr == INSTR_ALLOC)
+        if (code_line->instr == INSTR_ALLOC &&
+            code_line->roperand + code_line->loperand > memory)
         {
-            memory += code_line->loperand;
+            memory = code_line->roperand + code_line->loperand;
         }
     }
     return memory;
 }
 
-std::size_t Procedure::stack_move_value()
+/**
+ *  Give every ALLOC its offset within the allocated memory of the frame, in
+ *  the 'roperand' field. 'global_liveness' is the liveness information (by
+ *  formal register) of the procedure.
+ * 
+ *  The memory of an ALLOC is in use while a register holding an address into
+ *  it is alive, or while a callee may use such an address passed to it.
+ *  Arrays whose lifetimes do not overlap, such as arrays in sibling blocks,
+ *  share frame space. Offsets are handed out first-fit, in the order of the
+ *  start of lifetimes.
+ */
+void Procedure::assign_alloc_offsets(const std::vector<std::set<std::size_t>>& global_liveness)
 {
-    /** The stack frame is like:
-     * 
-     *  --------------------------
-     *       (in ra register)
-     *        return address
-     *   (after current function
-     *         call finishes)
-     *
-     *    0 bytes if "is_leaf()",
-     *    otherwise PTR_SIZE.
-     *  --------------------------
-     *      saved s3 register
-     *  --------------------------
-     *      saved s2 register
-     *      (as OPERAND_TEMP)
-     *  --------------------------
-     *      saved s1 register
-     *       (as DEST_TEMP)
-     *  --------------------------
-     *      saved s0 register
-     *      (as frame pointer)
-     *  --------------------------   <---- s0 register here
-     *     place to save t0-t6
-     *    
-     *    0 bytes if "is_leaf()",
-     *    otherwise INT_SIZE * 7.
-     *  --------------------------
-     *     potential free space
-     *       due to alignment
-     *  --------------------------
-     *       allocated_memory
-     *  --------------------------
-     *        spilled_memory
-     *  --------------------------
-     *       place to save >8 
-     *           func args
-     *  --------------------------   <---- sp register here
-     */
-    std::size_t move_value = max_spilled_memory() + 
-                             max_allocated_memory() +
-                             4 * INT_SIZE;
-    auto max_args = max_call_args();
-    if (max_args > 8)
+    /* Maps every register holding an address into allocated memory to the
+       ALLOC instruction (by index) that allocated the memory. */
+    std::map<std::size_t, std::size_t> points_to;
+    /* Lifetime of the memory of every ALLOC, as [first point, last point]. */
+    std::map<std::size_t, std::pair<std::size_t, std::size_t>> lifetime;
+    auto length = code.size();
+    for (std::size_t i = 0; i < length; i++)
     {
-        move_value += (max_args - 8) * INT_SIZE;
+        if (code[i]->instr == INSTR_ALLOC)
+        {
+            points_to[code[i]->dest] = i;
+            lifetime[i] = {i + 1, i + 1};
+        }
     }
-    if (has_call())
+    bool changed = true;
+    while (changed)
     {
-        move_value += (PTR_SIZE + 7 * INT_SIZE);
+        changed = false;
+        for (auto& code_line: code)
+        {
+            if (code_line->instr != INSTR_RRMOV &&
+                code_line->instr != INSTR_ADD &&
+                code_line->instr != INSTR_SUB)
+                continue;
+            for (auto& reg: use(code_line))
+            {
+                auto it = points_to.find(reg);
+                if (it != points_to.end() && points_to.count(code_line->dest) == 0)
+                {
+                    points_to[code_line->dest] = it->second;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    auto extend = [&lifetime](std::size_t alloc, std::size_t point)
+    {
+        auto& range = lifetime.at(alloc);
+        range.first = std::min(range.first, point);
+        range.second = std::max(range.second, point);
+    };
+    for (std::size_t i = 0; i < global_liveness.size(); i++)
+    {
+        for (auto& reg: global_liveness[i])
+        {
+            auto it = points_to.find(reg);
+            if (it != points_to.end())
+                extend(it->second, i);
+        }
+    }
+    for (std::size_t i = 0; i < length; i++)
+    {
+        if (code[i]->instr != INSTR_ARG)
+            continue;
+        auto it = points_to.find(code[i]->roperand);
+        if (it == points_to.end())
+            continue;
+        auto call = i;
+        while (call < length && code[call]->instr != INSTR_CALL)
+            call++;
+        extend(it->second, call);
+    }
+
+    std::vector<std::pair<std::pair<std::size_t, std::size_t>, std::size_t>> by_start;
+    for (auto& pair: lifetime)
+    {
+        by_start.push_back({pair.second, pair.first});
+    }
+    std::sort(by_start.begin(), by_start.end());
+    /* Memory in use, as offset -> (size, last point). */
+    std::map<std::size_t, std::pair<std::size_t, std::size_t>> active;
+    for (auto& interval: by_start)
+    {
+        auto start = interval.first.first, end = interval.first.second;
+        auto alloc = code[interval.second];
+        for (auto it = active.begin(); it != active.end(); )
+        {
+            if (it->second.second < start)
+                it = active.erase(it);
+            else
+                it++;
+        }
+        std::size_t offset = 0;
+        for (auto& used: active)
+        {
+            if (used.first >= offset + alloc->loperand)
+                break;
+            offset = std::max(offset, used.first + used.second.first);
+        }
+        active[offset] = {alloc->loperand, end};
+        alloc->roperand = offset;
     }
-    if (move_value % 16 == 0)
-        return move_value;
-    else
-        return (1 + move_value / 16) * 16;
 }
\ No newline at end of file
@@ -5,8 +5,52 @@ void register_alloc_optim(std::vector<IntermediateCode*>& code)
 {
     /* Decompose code into procedures (functions). */
     auto proc = make_procedures(code);
-    for (auto& p: proc)
+    /* The passes below delete instructions of the procedures, so only the
+       GLOB instructions of 'code' are kept for merging them back. */
+    std::vector<IntermediateCode*> globs;
+    for (auto& code_line: code)
+    {
+        if (code_line->instr == INSTR_GLOB)
+            globs.push_back(code_line);
+    }
+    NameSupply names(code);
+    /* Procedures are allocated callees first, so that the registers each
+       callee may write are known in its callers. */
+    std::map<std::size_t, std::set<std::size_t>> clobbers;
+    /* Small procedures are inlined at their calls. */
+    inline_procedures(proc, names);
+    auto effects = memory_effect_summaries(proc);
+    for (auto& p: bottom_up_order(proc))
     {
+        /* Globals that no call in a loop may access stay in registers. */
+        p->promote_globals(names, effects);
+
+        /* Reads of local variables read the variables, not copies of them. */
+        p->propagate_copies();
+
+        /* Optimizations on the SSA form of the procedure, each of which
+           must leave the PHIs in step with the blocks. */
+        p->to_ssa(names);
+        p->verify("SSA construction");
+        p->propagate_constants();
+        p->verify("constant propagation");
+        p->number_values();
+        p->verify("value numbering");
+        p->optimize_memory_accesses();
+        p->verify("memory access optimization");
+        p->hoist_loop_invariants(names);
+        p->verify("loop-invariant code motion");
+        p->number_values();
+        p->verify("value numbering");
+        p->reduce_induction_variables(names);
+        p->verify("induction variable reduction");
+        p->reduce_strength(names);
+        p->verify("strength reduction");
+        p->eliminate_dead_code();
+        p->verify("dead code elimination");
+        p->from_ssa(names);
+        p->verify("SSA destruction");
+
         /* Decompose procedures into basic blocks. */
         auto blocks = make_basic_blocks(p->code);
 
@@ -15,18 +59,41 @@ void register_alloc_optim(std::vector<IntermediateCode*>& code)
         updater.calculate_liveness();
         auto global_liveness = updater.to_global_liveness(p->code.size());
 
-        /* Register allocation. */
-        RegisterAllocator alloc(AllocationTable(p->register_range()));
-        alloc.allocate(p->code, global_liveness);
+        /* Fix the frame offsets of allocated memory, so that the addresses
+           can be rematerialized. Arrays with disjoint lifetimes share space. */
+        p->assign_alloc_offsets(global_liveness);
+
+        /* Register allocation. Constants and addresses are recomputed
+           where they are used if registers would run short. */
+        AllocationTable table(p->register_range());
+        auto remat = find_rematerializable(p->code, global_liveness,
+                                           table.free_registers.size());
+        MemorySpiller spiller;
+        for (auto& pair: remat)
+        {
+            table.rematerialized.insert(pair.first);
+            spiller.remat_map.insert({pair.first + (1 << 29), pair.second});
+        }
+        RegisterAllocator alloc(table);
+        alloc.allocate(p->code, global_liveness, clobbers);
+
+        /* Spill to frame slots, which are shared within the procedure
+           between registers whose live ranges do not overlap. */
+        spiller.assign_slots(p->code, global_liveness);
+        spiller.spill(p->code);
+        clobbers[p->addr] = p->clobbered_registers(clobbers);
         for (auto & b: blocks)
         {
             delete b;
         }
+
+        /* Place likely successors as fall-throughs. */
+        p->layout_blocks(names);
     }
+    code = merge_procedures(globs, proc);
     for (auto& p: proc)
     {
         delete p;
     }
-    MemorySpiller().spill(code);
     remove_useless_mov(code);
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "basicblock.h"
 #include <queue>
+#include <algorithm>
 
 AllocationTable::AllocationTable(std::pair<std::size_t, std::size_t> _register_range): 
 allocation_table(_register_range.second - _register_range.first)
@@ -10,6 +11,10 @@ allocation_table(_register_range.second - _register_range.first)
     }
     register_lower_range = _register_range.first;
     free_registers = std::set<std::size_t>({1, 2, 3, 4, 5, 6, 7});
+    for (std::size_t i = 0; i < 8; i++)
+    {
+        free_registers.insert(ARG_REGISTER(i));
+    }
 }
 
 const std::size_t& AllocationTable::operator[](std::size_t reg) const
@@ -27,6 +32,142 @@ RegisterModifier::RegisterModifier(const AllocationTable& _alloc_table): alloc_t
 
 }
 
+/**
+ *  Collect what the choice of physical registers depends on: the live ranges
+ *  of formal registers, the hints that let arguments and return values stay in
+ *  their argument registers, and where argument registers are unavailable.
+ */
+void RegisterModifier::prepare(const std::vector<IntermediateCode*>& _code,
+                               const std::vector<std::set<std::size_t>>& _global_liveness,
+                               const std::map<std::size_t, std::set<std::size_t>>& _clobbers)
+{
+    for (std::size_t i = 0; i < _global_liveness.size(); i++)
+    {
+        for (auto& reg: _global_liveness[i])
+        {
+            auto it = live_range.find(reg);
+            if (it == live_range.end())
+                live_range[reg] = {i, i};
+            else
+                it->second.second = i;
+        }
+    }
+
+    /* ARG instructions of the call being prepared, as (argument, instruction). */
+    std::vector<std::pair<std::size_t, std::size_t>> args;
+    std::vector<std::size_t> masks;
+    auto num_lines = _code.size();
+    for (std::size_t i = 0; i < num_lines; i++)
+    {
+        auto code_line = _code[i];
+        switch (code_line->instr)
+        {
+            case INSTR_LARG:
+                if (code_line->roperand < 8)
+                {
+                    auto reg = ARG_REGISTER(code_line->roperand);
+                    hints.insert({code_line->loperand, reg});
+                    if (i > 0)
+                        reserved[reg].push_back({0, i - 1});
+                }
+                break;
+            case INSTR_ARG:
+                if (code_line->loperand < 8)
+                {
+                    hints.insert({code_line->roperand, ARG_REGISTER(code_line->loperand)});
+                    args.push_back({code_line->loperand, i});
+                }
+                break;
+            case INSTR_CALL:
+            {
+                hints.insert({code_line->dest, ARG_REGISTER(0)});
+                calls.push_back(i);
+                /* The result is returned in a0 in any case. */
+                std::size_t mask = (std::size_t)1 << ARG_REGISTER(0);
+                auto it = _clobbers.find(code_line->loperand);
+                for (std::size_t reg = 1; reg <= ARG_REGISTER(7); reg++)
+                {
+                    if (is_caller_saved(reg) &&
+                        (it == _clobbers.end() || it->second.count(reg) > 0))
+                        mask |= (std::size_t)1 << reg;
+                }
+                masks.push_back(mask);
+                /* The ARG writes the argument register, so it is reserved
+                   from the point after the ARG to the call, even when the
+                   ARG comes right before the call: 'fits' takes the range
+                   [i, i - 1] as the point before the call. */
+                for (auto& arg: args)
+                {
+                    reserved[ARG_REGISTER(arg.first)].push_back({arg.second + 1, i - 1});
+                }
+                args.clear();
+                break;
+            }
+            case INSTR_RET:
+                if (code_line->loperand != 0)
+                    hints.insert({code_line->loperand, ARG_REGISTER(0)});
+                break;
+            default:
+                break;
+        }
+    }
+
+    clobber_table.push_back(masks);
+    for (std::size_t k = 1; ((std::size_t)1 << k) <= masks.size(); k++)
+    {
+        auto& prev = clobber_table[k - 1];
+        std::vector<std::size_t> level;
+        auto half = (std::size_t)1 << (k - 1);
+        for (std::size_t i = 0; i + 2 * half <= masks.size(); i++)
+        {
+            level.push_back(prev[i] | prev[i + half]);
+        }
+        clobber_table.push_back(level);
+    }
+}
+
+/**
+ *  Caller-saved registers, as a bit mask, that may be written by the calls
+ *  within the live range of the formal register 'formal'.
+ */
+std::size_t RegisterModifier::clobbered_during(std::size_t formal)
+{
+    auto start = live_range.at(formal).first, end = live_range.at(formal).second;
+    std::size_t first = std::lower_bound(calls.begin(), calls.end(), start) - calls.begin();
+    std::size_t last = std::upper_bound(calls.begin(), calls.end(), end) - calls.begin();
+    if (first >= last)
+        return 0;
+    std::size_t k = 0;
+    while (((std::size_t)2 << k) <= last - first)
+        k++;
+    return clobber_table[k][first] | clobber_table[k][last - ((std::size_t)1 << k)];
+}
+
+/**
+ *  Whether the physical register 'reg' can hold the formal register 'formal'
+ *  for its whole live range. A formal register live over [s, e] is written by
+ *  instruction s - 1 and last read by instruction e. 
+ * 
+ *  Temporary registers are saved around calls that write them, so they always
+ *  fit. An argument register does not fit if a call within the live range
+ *  writes it, or if the live range overlaps a range during which the argument
+ *  register is reserved.
+ */
+bool RegisterModifier::fits(std::size_t formal, std::size_t reg)
+{
+    if (reg < ARG_REGISTER(0))
+        return true;
+    if (clobbered_during(formal) & ((std::size_t)1 << reg))
+        return false;
+    auto start = live_range.at(formal).first, end = live_range.at(formal).second;
+    for (auto& range: reserved[reg])
+    {
+        if (start <= range.second + 1 && end >= range.first)
+            return false;
+    }
+    return true;
+}
+
 static void modify_code_use(IntermediateCode* code, const AllocationTable& alloc_table)
 {
     switch (code->instr)
@@ -48,6 +189,9 @@ static void modify_code_use(IntermediateCode* code, const AllocationTable& alloc
         case INSTR_NEG:
         case INSTR_NOT:
         case INSTR_BOOL:
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
             code->loperand = alloc_table[code->loperand];
             return;
         case INSTR_ADD:
@@ -61,6 +205,7 @@ static void modify_code_use(IntermediateCode* code, const AllocationTable& alloc
         case INSTR_LEQ:
         case INSTR_EQ:
         case INSTR_NEQ:
+        case INSTR_MULH:
             code->loperand = alloc_table[code->loperand];
             code->roperand = alloc_table[code->roperand];
             return;
@@ -70,6 +215,15 @@ static void modify_code_use(IntermediateCode* code, const AllocationTable& alloc
         case INSTR_JNE:
             code->loperand = alloc_table[code->loperand];
             return;
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
+            code->loperand = alloc_table[code->loperand];
+            code->dest = alloc_table[code->dest];
+            return;
         case INSTR_ARG:
             code->roperand = alloc_table[code->roperand];
             return;
@@ -122,11 +276,21 @@ static void modify_code_def(IntermediateCode* code, const AllocationTable& alloc
         case INSTR_LEQ:
         case INSTR_EQ:
         case INSTR_NEQ:
+        case INSTR_SLL:
+        case INSTR_SRL:
+        case INSTR_SRA:
+        case INSTR_MULH:
             code->dest = alloc_table[code->dest];
             return;
         case INSTR_JMP:
         case INSTR_JE:
         case INSTR_JNE:
+        case INSTR_JGT:
+        case INSTR_JGEQ:
+        case INSTR_JLT:
+        case INSTR_JLEQ:
+        case INSTR_JEQ:
+        case INSTR_JNEQ:
         case INSTR_ARG:
             return;
         case INSTR_LARG:
@@ -175,17 +339,54 @@ void RegisterModifier::modify(IntermediateCode* _code,
 
     for (auto& v: needed)
     {
-        if (alloc_table.free_registers.empty()) /* Spill to memory. */
+        if (alloc_table.rematerialized.count(v) > 0) /* Recomputed at every use. */
             this->alloc_table[v] = (1 << 29) + v;
         else
         {
-            auto min_reg = *alloc_table.free_registers.begin();
-            alloc_table.free_registers.erase(min_reg);
-            alloc_table[v] = min_reg;
+            /* Try the hint first, then the register of the source of a move
+               that dies here, so that the move can be removed. Argument
+               registers are tried before temporary registers, and registers
+               that no call within the live range writes come first. */
+            std::vector<std::size_t> candidates;
+            auto hint = hints.find(v);
+            if (hint != hints.end())
+                candidates.push_back(hint->second);
+            if (_code->instr == INSTR_RRMOV && _code->dest == v)
+                candidates.push_back(_code->loperand);
+            for (std::size_t i = 8; i > 0; i--)
+            {
+                candidates.push_back(ARG_REGISTER(i - 1));
+            }
+            for (std::size_t reg = 1; reg <= 7; reg++)
+            {
+                candidates.push_back(reg);
+            }
+            auto clobbered = clobbered_during(v);
+            std::stable_partition(candidates.begin(), candidates.end(),
+                                  [clobbered](std::size_t reg)
+                                  {
+                                      return (clobbered & ((std::size_t)1 << reg)) == 0;
+                                  });
+
+            this->alloc_table[v] = (1 << 29) + v; /* Spill to memory if none fits. */
+            for (auto& reg: candidates)
+            {
+                if (alloc_table.free_registers.count(reg) > 0 && fits(v, reg))
+                {
+                    alloc_table.free_registers.erase(reg);
+                    alloc_table[v] = reg;
+                    break;
+                }
+            }
         }
     }
 
+    /* The result of a call that is never read is left in a0, so that it
+       is neither moved nor saved. */
+    bool dead_result = (_code->instr == INSTR_CALL && _after.count(_code->dest) == 0);
     modify_code_def(_code, this->alloc_table);
+    if (dead_result)
+        _code->dest = ARG_REGISTER(0);
 }
 
 RegisterAllocator::RegisterAllocator(const AllocationTable& _alloc_table): modifier(_alloc_table)
@@ -194,8 +395,10 @@ RegisterAllocator::RegisterAllocator(const AllocationTable& _alloc_table): modif
 }
 
 void RegisterAllocator::allocate(const std::vector<IntermediateCode*>& _code,
-                                 const std::vector<std::set<std::size_t>>& _global_liveness)
+                                 const std::vector<std::set<std::size_t>>& _global_liveness,
+                                 const std::map<std::size_t, std::set<std::size_t>>& _clobbers)
 {
+    modifier.prepare(_code, _global_liveness, _clobbers);
     auto num_lines = _code.size();
     for (std::size_t i = 0; i < num_lines; i++)
     {
@@ -0,0 +1,91 @@
+#include "basicblock.h"
+#include <algorithm>
+
+/**
+ *  Find the formal registers of a procedure that should be rematerialized
+ *  instead of being given a physical register. 'global_liveness' is the
+ *  liveness information (by formal register) of the procedure, and
+ *  'num_registers' is the number of physical registers to allocate.
+ *
+ *  A register is rematerializable if it is defined exactly once, by an IRMOV
+ *  (a constant or a global address) or an ALLOC (a frame address, whose offset
+ *  is fixed before register allocation). Such a value can be recomputed by a
+ *  single instruction wherever it is used, which is never more expensive than
+ *  loading it from a frame slot.
+ *
+ *  Rematerializing a register is only worth it if the register would otherwise
+ *  compete for a physical register, so we pick candidates, longest live range
+ *  first, as long as more registers than available are alive at some point of
+ *  their live ranges.
+ */
+std::map<std::size_t, Rematerialization> find_rematerializable(
+    const std::vector<IntermediateCode*>& code,
+    const std::vector<std::set<std::size_t>>& global_liveness,
+    std::size_t num_registers)
+{
+    std::map<std::size_t, std::size_t> def_count;
+    std::map<std::size_t, IntermediateCode*> def_instr;
+    for (auto& code_line: code)
+    {
+        for (auto& reg: def(code_line))
+        {
+            def_count[reg]++;
+            def_instr[reg] = code_line;
+        }
+    }
+
+    /* Live range of every candidate, as [first point, last point]. */
+    std::map<std::size_t, std::pair<std::size_t, std::size_t>> range;
+    for (std::size_t i = 0; i < global_liveness.size(); i++)
+    {
+        for (auto& reg: global_liveness[i])
+        {
+            if (def_count[reg] != 1)
+                continue;
+            auto instr = def_instr.at(reg)->instr;
+            if (instr != INSTR_IRMOV && instr != INSTR_ALLOC)
+                continue;
+            auto it = range.find(reg);
+            if (it == range.end())
+                range[reg] = {i, i};
+            else
+                it->second.second = i;
+        }
+    }
+
+    std::vector<std::pair<std::size_t, std::size_t>> by_length;
+    for (auto& pair: range)
+    {
+        by_length.push_back({pair.second.second - pair.second.first, pair.first});
+    }
+    std::sort(by_length.begin(), by_length.end(),
+              [](const std::pair<std::size_t, std::size_t>& a,
+                 const std::pair<std::size_t, std::size_t>& b)
+              {
+                  return a.first > b.first || (a.first == b.first && a.second < b.second);
+              });
+
+    std::vector<std::size_t> pressure(global_liveness.size());
+    for (std::size_t i = 0; i < global_liveness.size(); i++)
+    {
+        pressure[i] = global_liveness[i].size();
+    }
+
+    std::map<std::size_t, Rematerialization> remat;
+    for (auto& candidate: by_length)
+    {
+        auto reg = candidate.second;
+        auto first = range.at(reg).first, last = range.at(reg).second;
+        auto max_pressure = *std::max_element(pressure.begin() + first,
+                                              pressure.begin() + last + 1);
+        if (max_pressure <= num_registers)
+            continue;
+        for (auto i = first; i <= last; i++)
+        {
+            pressure[i]--;
+        }
+        auto code_line = def_instr.at(reg);
+        remat.insert({reg, {code_line->instr, code_line->loperand, code_line->roperand}});
+    }
+    return remat;
+}
@@ -1,21 +1,33 @@
 #include "basicblock.h"
 
+/**
+ *  Remove moves from a register to itself. The labels of a removed move are
+ *  carried over to the next instruction of the same procedure. The code is
+ *  streamed into a new buffer, so that the pass takes linear time.
+ */
 void remove_useless_mov(std::vector<IntermediateCode*>& code)
 {
     auto length = code.size();
-    auto begin = code.begin();
+    std::vector<IntermediateCode*> kept;
+    kept.reserve(length);
+    std::vector<std::size_t> carried_labels;
     for (std::size_t i = 0; i < length; i++)
     {
-        if (code[i]->instr == INSTR_RRMOV && code[i]->dest == code[i]->loperand
-         && length > 1 && (i == length - 1 || code[i + 1]->labels.size() == 0))
+        auto code_line = code[i];
+        if (carried_labels.size() > 0)
         {
-            std::vector<std::size_t> labels(code[i]->labels);
-            delete code[i];
-            code.erase(begin + i);
-            if (i < length - 1)
-                (*(begin + i))->labels = labels;
-            length--;
-            i--;
+            code_line->labels.insert(code_line->labels.begin(),
+                                     carried_labels.begin(), carried_labels.end());
+            carried_labels.clear();
         }
+        if (code_line->instr == INSTR_RRMOV && code_line->dest == code_line->loperand
+         && i < length - 1 && code[i + 1]->instr != INSTR_GLOB)
+        {
+            carried_labels.swap(code_line->labels);
+            delete code_line;
+            continue;
+        }
+        kept.push_back(code_line);
     }
+    code.swap(kept);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "basicblock.h"
+#include <algorithm>
 
 static bool is_memory(std::size_t addr_or_label)
 {
@@ -15,374 +16,373 @@ std::size_t MemorySpiller::next_addr()
     return addr++;
 }
 
-void MemorySpiller::spill(std::vector<IntermediateCode*>& code)
+/**
+ *  Assign a frame slot to every spilled register of a procedure, after
+ *  register allocation. 'global_liveness' is the liveness information
+ *  (by formal register) that the allocation was based on.
+ * 
+ *  Two spilled registers share a slot if their live ranges do not overlap.
+ *  Since live ranges are intervals of program points, this is the coloring
+ *  of an interval graph, for which handing out the first free slot in the
+ *  order of interval starts is optimal.
+ *
+ *  Slots are then ordered by how often they are accessed, hottest first.
+ */
+void MemorySpiller::assign_slots(const std::vector<IntermediateCode*>& code,
+                                 const std::vector<std::set<std::size_t>>& global_liveness)
 {
+    /* Live range of every spilled register, as [first point, last point].
+       Program point 'i' is right before instruction 'i'. */
+    std::map<std::size_t, std::pair<std::size_t, std::size_t>> range;
+    auto extend = [&range](std::size_t reg, std::size_t point)
+    {
+        auto it = range.find(reg);
+        if (it == range.end())
+            range[reg] = {point, point};
+        else
+        {
+            it->second.first = std::min(it->second.first, point);
+            it->second.second = std::max(it->second.second, point);
+        }
+    };
     auto length = code.size();
     for (std::size_t i = 0; i < length; i++)
     {
-        auto code_line = code[i];
-        auto dest = code_line->dest, loperand = code_line->loperand,
-            roperand = code_line->roperand, instr = code_line->instr;
-        std::vector<std::size_t> labels(code_line->labels);
-        switch (instr)
+        for (auto& reg: use(code[i]))
         {
-            case INSTR_ALLOC:
-            case INSTR_IRMOV:
-            case INSTR_CALL:
-                if (is_memory(dest))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
-                    /* Move immediate to DEST_TEMP */
-                    code.insert(code.begin() + i,
-                    new IntermediateCode(instr, DEST_TEMP, loperand, roperand, labels));
-                    /* Save DEST_TEMP to dest */
-                    try
-                    {
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                    } catch (const std::out_of_range& e)
-                    {
-                        
-                        memory_map[dest] = 4 * next_addr();
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                    }
-                    i++;
-                    length++;
-                }
-                break;
-            case INSTR_LARG:
-                if (is_memory(loperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
-                    code.insert(code.begin() + i,
-                    new IntermediateCode(instr, PLACEHOLDER, DEST_TEMP, roperand, labels));
-                    /* Save DEST_TEMP to dest */
-                    try
-                    {
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(loperand), PLACEHOLDER, labels));
-                    } catch (const std::out_of_range& e)
-                    {
-                        
-                        memory_map[loperand] = 4 * next_addr();
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(loperand), PLACEHOLDER, labels));
-                    }
-                    i++;
-                    length++;
-                }
-                break;
-            case INSTR_RRMOV:
-                if (is_memory(dest) || is_memory(loperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
+            if (is_memory(reg) && remat_map.count(reg) == 0)
+                extend(reg, i);
+        }
+        /* A definition writes the slot even if the value is never used,
+           so the point right after it must belong to the range. */
+        for (auto& reg: def(code[i]))
+        {
+            if (is_memory(reg) && remat_map.count(reg) == 0)
+                extend(reg, i + 1);
+        }
+    }
+    for (std::size_t i = 0; i < global_liveness.size(); i++)
+    {
+        for (auto& reg: global_liveness[i])
+        {
+            if (range.find(reg + (1 << 29)) != range.end())
+                extend(reg + (1 << 29), i);
+        }
+    }
 
-                    /* Move 'loperand' to DEST_TEMP */
-                    if (is_memory(loperand))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                    }
-                    else
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_RRMOV, DEST_TEMP, loperand, roperand, labels));
-                    }
-                    
-                    /* Move DEST_TEMP to dest */
-                    if (is_memory(dest))
-                    {
-                        try
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        } catch (const std::out_of_range& e)
-                        {
-                            
-                            memory_map[dest] = 4 * next_addr();
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        }
-                    }
-                    else
-                    {
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_RRMOV, dest, DEST_TEMP, roperand, labels));
-                    }
+    std::vector<std::pair<std::pair<std::size_t, std::size_t>, std::size_t>> by_start;
+    for (auto& pair: range)
+    {
+        by_start.push_back({pair.second, pair.first});
+    }
+    std::sort(by_start.begin(), by_start.end());
 
-                    i++;
-                    length++;
-                }
-                break;
-            case INSTR_MRMOV:
-            case INSTR_NEG:
-            case INSTR_NOT:
-            case INSTR_BOOL:
-                if (is_memory(dest) || is_memory(loperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
+    /* slot_end[k] is the last point at which slot 'k' is occupied. */
+    std::vector<std::size_t> slot_end;
+    for (auto& interval: by_start)
+    {
+        auto start = interval.first.first, end = interval.first.second;
+        std::size_t slot = 0;
+        while (slot < slot_end.size() && slot_end[slot] >= start)
+            slot++;
+        if (slot == slot_end.size())
+            slot_end.push_back(end);
+        else
+            slot_end[slot] = end;
+        memory_map[interval.second] = slot;
+        live_until[interval.second] = end;
+    }
+    addr = slot_end.size();
 
-                    if (is_memory(loperand) && is_memory(dest))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(instr, DEST_TEMP, DEST_TEMP, roperand, labels));
-                        try
-                        {
-                            code.insert(code.begin() + i + 2,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        } catch (const std::out_of_range& e)
-                        {
-                            
-                            memory_map[dest] = 4 * next_addr();
-                            code.insert(code.begin() + i + 2,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        }
-                        i += 2;
-                        length += 2;
-                    }
-                    else if (is_memory(loperand) && !is_memory(dest))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(instr, dest, DEST_TEMP, roperand, labels));
-                        i++;
-                        length++;
-                    }
-                    else if (is_memory(dest) && !is_memory(loperand))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(instr, DEST_TEMP, loperand, roperand, labels));
-                        try
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        } catch (const std::out_of_range& e)
-                        {
-                            
-                            memory_map[dest] = 4 * next_addr();
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        }
-                        i++;
-                        length++;
-                    }
-                }
-                break;
-            case INSTR_ADD:
-            case INSTR_SUB:
-            case INSTR_MUL:
-            case INSTR_DIV:
-            case INSTR_MOD:
-            case INSTR_GT:
-            case INSTR_GEQ:
-            case INSTR_LT:
-            case INSTR_LEQ:
-            case INSTR_EQ:
-            case INSTR_NEQ:
-                if (is_memory(dest) || is_memory(loperand) || is_memory(roperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
-                    if (is_memory(loperand) && is_memory(roperand))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADO, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(roperand), labels));
-                        if (is_memory(dest))
-                        {
-                            code.insert(code.begin() + i + 2,
-                            new IntermediateCode(instr, DEST_TEMP, OPERAND_TEMP, DEST_TEMP, labels));
-                            try
-                            {
-                                code.insert(code.begin() + i + 3,
-                                new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                            } catch (const std::out_of_range& e)
-                            {
-                                
-                                memory_map[dest] = 4 * next_addr();
-                                code.insert(code.begin() + i + 3,
-                                new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                            }
-                            i += 3;
-                            length += 3;
-                        }
-                        else
-                        {
-                            code.insert(code.begin() + i + 2,
-                            new IntermediateCode(instr, dest, OPERAND_TEMP, DEST_TEMP, labels));
-                            i += 2;
-                            length += 2;
-                        }
-                    }
-                    else if (is_memory(loperand) && !is_memory(roperand))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADO, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                        if (is_memory(dest))
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(instr, DEST_TEMP, OPERAND_TEMP, roperand, labels));
-                            try
-                            {
-                                code.insert(code.begin() + i + 2,
-                                new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                            } catch (const std::out_of_range& e)
-                            {
-                                
-                                memory_map[dest] = 4 * next_addr();
-                                code.insert(code.begin() + i + 2,
-                                new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                            }
-                            i += 2;
-                            length += 2;
-                        }
-                        else
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(instr, dest, OPERAND_TEMP, roperand, labels));
-                            i++;
-                            length++;
-                        }
-                    }
-                    else if (!is_memory(loperand) && is_memory(roperand))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(roperand), labels));
-                        if (is_memory(dest))
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(instr, DEST_TEMP, loperand, DEST_TEMP, labels));
-                            try
-                            {
-                                code.insert(code.begin() + i + 2,
-                                new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                            } catch (const std::out_of_range& e)
-                            {
-                                
-                                memory_map[dest] = 4 * next_addr();
-                                code.insert(code.begin() + i + 2,
-                                new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                            }
-                            i += 2;
-                            length += 2;
-                        }
-                        else
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(instr, dest, loperand, DEST_TEMP, labels));
-                            i++;
-                            length++;
-                        }
-                    }
-                    else
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(instr, DEST_TEMP, loperand, roperand, labels));
-                        try
-                        {
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        } catch (const std::out_of_range& e)
-                        {
-                            
-                            memory_map[dest] = 4 * next_addr();
-                            code.insert(code.begin() + i + 1,
-                            new IntermediateCode(INSTR_SAVE, PLACEHOLDER, memory_map.at(dest), PLACEHOLDER, labels));
-                        }
-                        i++;
-                        length++;
-                    }
-                }
-                break;
+    /* Put the most frequently accessed slots nearest to sp, so that they are
+       the last to need a large offset. An access within 'd' loops counts as
+       8^d accesses, where loops are the ranges spanned by backward jumps. */
+    std::map<std::size_t, std::size_t> label_at;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        for (auto& label: code[i]->labels)
+        {
+            label_at[label] = i;
+        }
+    }
+    std::vector<std::size_t> depth(length + 1, 0);
+    for (std::size_t i = 0; i < length; i++)
+    {
+        auto instr = code[i]->instr;
+        if (instr != INSTR_JMP && instr != INSTR_JE && instr != INSTR_JNE &&
+            !IS_COMPARE_JUMP(instr))
+            continue;
+        auto it = label_at.find(code[i]->roperand);
+        if (it == label_at.end() || it->second > i)
+            continue;
+        for (auto j = it->second; j <= i; j++)
+        {
+            depth[j]++;
+        }
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> weight(addr);
+    for (std::size_t slot = 0; slot < addr; slot++)
+    {
+        weight[slot] = {0, slot};
+    }
+    for (std::size_t i = 0; i < length; i++)
+    {
+        std::size_t frequency = 1;
+        for (std::size_t d = 0; d < depth[i] && d < 6; d++)
+        {
+            frequency *= 8;
+        }
+        auto regs = use(code[i]);
+        for (auto& reg: def(code[i]))
+        {
+            regs.insert(reg);
+        }
+        for (auto& reg: regs)
+        {
+            auto it = memory_map.find(reg);
+            if (it != memory_map.end())
+                weight[it->second].first += frequency;
+        }
+    }
+    std::sort(weight.begin(), weight.end(),
+              [](const std::pair<std::size_t, std::size_t>& a,
+                 const std::pair<std::size_t, std::size_t>& b)
+              {
+                  return a.first > b.first || (a.first == b.first && a.second < b.second);
+              });
+    std::vector<std::size_t> rank(addr);
+    for (std::size_t k = 0; k < addr; k++)
+    {
+        rank[weight[k].second] = k;
+    }
+    for (auto& pair: memory_map)
+    {
+        pair.second = INT_SIZE * rank[pair.second];
+    }
+}
 
-            case INSTR_RMMOV:
-                if (is_memory(dest) || is_memory(loperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
+static bool is_jump(IntermediateCode* code)
+{
+    return code->instr == INSTR_JMP || code->instr == INSTR_JE ||
+           code->instr == INSTR_JNE || IS_COMPARE_JUMP(code->instr) ||
+           code->instr == INSTR_RET;
+}
 
-                    if (is_memory(loperand) && is_memory(dest))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADO, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(dest), labels));
-                        code.insert(code.begin() + i + 2,
-                        new IntermediateCode(INSTR_RMMOV, DEST_TEMP, OPERAND_TEMP, roperand, labels));
-                        i += 2;
-                        length += 2;
-                    }
-                    else if (is_memory(loperand) && !is_memory(dest))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADO, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_RMMOV, dest, OPERAND_TEMP, roperand, labels));
-                        i++;
-                        length++;
-                    }
-                    else if (is_memory(dest) && !is_memory(loperand))
-                    {
-                        code.insert(code.begin() + i,
-                        new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(dest), labels));
-                        code.insert(code.begin() + i + 1,
-                        new IntermediateCode(INSTR_RMMOV, DEST_TEMP, loperand, roperand, labels));
-                        i++;
-                        length++;
-                    }
-                }
-                break;
-            case INSTR_JE:
-            case INSTR_JNE:
-            case INSTR_RET:
-                if (is_memory(loperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
+/**
+ *  Rewrite every access to a spilled register into an access to its frame
+ *  slot. A spilled operand is loaded to OPERAND_TEMP or DEST_TEMP before the
+ *  instruction, and a spilled result is computed in DEST_TEMP and saved after
+ *  the instruction.
+ * 
+ *  A rematerialized register is recomputed into OPERAND_TEMP or DEST_TEMP in
+ *  place of the load, and the instruction defining it is dropped. A move from
+ *  a rematerialized register becomes the recomputation itself.
+ * 
+ *  Within a basic block, we remember which slot each of the two temporary
+ *  registers mirrors. A load is dropped if a temporary register already holds
+ *  the slot, and a save is dropped if it is overwritten by another save, or
+ *  if the register owning the slot dies, before the slot is loaded again.
+ *  Both temporary registers are callee-saved, so calls do not clobber them.
+ * 
+ *  The rewritten code is streamed into a new buffer, so that the pass takes
+ *  linear time in the length of the procedure.
+ */
+void MemorySpiller::spill(std::vector<IntermediateCode*>& code)
+{
+    const std::size_t no_slot = (std::size_t)(-1);
+    std::vector<IntermediateCode*> spilled;
+    spilled.reserve(code.size());
+    /* Whether an instruction in 'spilled' turns out to be a dead save. */
+    std::vector<bool> dead;
+    dead.reserve(code.size());
+    /* The slot whose value each temporary register holds. */
+    std::map<std::size_t, std::size_t> mirror = {{DEST_TEMP, no_slot}, {OPERAND_TEMP, no_slot}};
+    /* Saves that no load has read yet, as slot -> (index in 'spilled', saved register). */
+    std::map<std::size_t, std::pair<std::size_t, std::size_t>> pending;
 
-                    code.insert(code.begin() + i,
-                    new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(loperand), labels));
-                    code.insert(code.begin() + i + 1,
-                    new IntermediateCode(instr, dest, DEST_TEMP, roperand, labels));
-                    i++;
-                    length++;
-                }
-                break;
-            case INSTR_ARG:
-                if (is_memory(roperand))
-                {
-                    delete code_line;
-                    code.erase(code.begin() + i);
+    auto length = code.size();
+    for (std::size_t i = 0; i < length; i++)
+    {
+        auto code_line = code[i];
+        if (code_line->labels.size() > 0) /* A new basic block begins. */
+        {
+            mirror[DEST_TEMP] = mirror[OPERAND_TEMP] = no_slot;
+            pending.clear();
+        }
+        for (auto it = pending.begin(); it != pending.end(); )
+        {
+            if (live_until.at(it->second.second) < i) /* The saved register is dead. */
+            {
+                dead[it->second.first] = true;
+                it = pending.erase(it);
+            }
+            else
+                it++;
+        }
 
-                    code.insert(code.begin() + i,
-                    new IntermediateCode(INSTR_LOADD, PLACEHOLDER, PLACEHOLDER, memory_map.at(roperand), labels));
-                    code.insert(code.begin() + i + 1,
-                    new IntermediateCode(instr, dest, loperand, DEST_TEMP, labels));
-                    i++;
-                    length++;
-                }
-                break;
-            case INSTR_GLOB:
-                for (auto& entry: symbol_table->get_entries())
+        if (code_line->instr == INSTR_RRMOV && remat_map.count(code_line->loperand) > 0)
+        {
+            auto& remat = remat_map.at(code_line->loperand);
+            code_line->instr = remat.instr;
+            code_line->loperand = remat.loperand;
+            code_line->roperand = remat.roperand;
+        }
+        auto uses = use_fields(code_line);
+        auto def_ = def_field(code_line);
+        std::vector<std::size_t> memory_uses;
+        for (auto& field: uses)
+        {
+            if (is_memory(*field) &&
+                std::find(memory_uses.begin(), memory_uses.end(), *field) == memory_uses.end())
+                memory_uses.push_back(*field);
+        }
+        bool memory_def = (def_ != nullptr && is_memory(*def_));
+        if (memory_def && remat_map.count(*def_) > 0) /* Recomputed where used. */
+        {
+            spilled.push_back(code_line);
+            dead.push_back(true);
+            continue;
+        }
+        if (memory_uses.size() == 0 && !memory_def)
+        {
+            spilled.push_back(code_line);
+            dead.push_back(false);
+            if (is_jump(code_line))
+                pending.clear();
+            continue;
+        }
+
+        /* The labels go to the first instruction of the rewritten sequence. */
+        std::vector<std::size_t> labels;
+        labels.swap(code_line->labels);
+
+        /* Decide which temporary register each spilled operand is read from,
+           reusing a temporary register that already holds its slot. */
+        /* A rematerialized register is mirrored under its own name, since it
+           has no slot. */
+        auto slot_of = [this](std::size_t reg)
+        {
+            return remat_map.count(reg) > 0 ? reg : memory_map.at(reg);
+        };
+        std::map<std::size_t, std::size_t> temp_of;
+        std::set<std::size_t> taken;
+        for (auto& reg: memory_uses)
+        {
+            for (auto temp: {OPERAND_TEMP, DEST_TEMP})
+            {
+                if (mirror[temp] == slot_of(reg) && taken.count(temp) == 0)
                 {
-                    if (entry->addr == loperand && entry->type.basic_type == BASIC_TYPE_FUNC)
-                    {
-                        addr = 0;
-                        break;
-                    }
+                    temp_of[reg] = temp;
+                    taken.insert(temp);
+                    break;
                 }
-                break;
-            default:
-                break;
+            }
+        }
+        for (auto& reg: memory_uses)
+        {
+            if (temp_of.count(reg) > 0)
+                continue;
+            auto temp = taken.count(OPERAND_TEMP) == 0 ? OPERAND_TEMP : DEST_TEMP;
+            auto slot = slot_of(reg);
+            auto it = remat_map.find(reg);
+            if (it != remat_map.end())
+            {
+                spilled.push_back(new IntermediateCode(
+                    it->second.instr, temp, it->second.loperand, it->second.roperand, labels
+                ));
+            }
+            else
+            {
+                spilled.push_back(new IntermediateCode(
+                    temp == OPERAND_TEMP ? INSTR_LOADO : INSTR_LOADD,
+                    PLACEHOLDER, PLACEHOLDER, slot, labels
+                ));
+            }
+            dead.push_back(false);
+            temp_of[reg] = temp;
+            taken.insert(temp);
+            mirror[temp] = slot;
+            pending.erase(slot);
+        }
+        for (auto& field: uses)
+        {
+            if (is_memory(*field))
+                *field = temp_of.at(*field);
+        }
+
+        std::size_t save_to = PLACEHOLDER;
+        if (memory_def)
+        {
+            save_to = *def_;
+            *def_ = DEST_TEMP;
+        }
+        bool value_in_memory = false;
+        if (code_line->instr == INSTR_RRMOV && code_line->dest == code_line->loperand)
+        {
+            /* The value is already in DEST_TEMP. */
+            value_in_memory = (mirror[DEST_TEMP] == memory_map.at(save_to));
+            /* A save of the copied register not yet read now saves the copy,
+               and must stay as long as the copy is live. */
+            auto it = pending.find(mirror[DEST_TEMP]);
+            if (value_in_memory && it != pending.end() &&
+                live_until.at(save_to) > live_until.at(it->second.second))
+                it->second.second = save_to;
+            delete code_line;
+        }
+        else
+        {
+            code_line->labels.swap(labels);
+            spilled.push_back(code_line);
+            dead.push_back(false);
+            if (def_ != nullptr && *def_ == DEST_TEMP)
+                mirror[DEST_TEMP] = no_slot;
+        }
+        if (memory_def && !value_in_memory)
+        {
+            std::size_t slot;
+            try
+            {
+                slot = memory_map.at(save_to);
+            } catch (const std::out_of_range& e)
+            {
+                slot = memory_map[save_to] = INT_SIZE * next_addr();
+                live_until[save_to] = length;
+            }
+            auto it = pending.find(slot);
+            if (it != pending.end()) /* Overwritten before being read. */
+                dead[it->second.first] = true;
+            pending[slot] = {spilled.size(), save_to};
+            spilled.push_back(new IntermediateCode(
+                INSTR_SAVE, PLACEHOLDER, slot, PLACEHOLDER, labels
+            ));
+            dead.push_back(false);
+            if (mirror[OPERAND_TEMP] == slot)
+                mirror[OPERAND_TEMP] = no_slot;
+            mirror[DEST_TEMP] = slot;
+        }
+        if (is_jump(spilled.back()))
+            pending.clear();
+    }
+
+    /* Drop dead saves, moving their labels to the next instruction. */
+    code.clear();
+    std::vector<std::size_t> carried_labels;
+    auto spilled_length = spilled.size();
+    for (std::size_t i = 0; i < spilled_length; i++)
+    {
+        if (dead[i])
+        {
+            carried_labels.insert(carried_labels.end(),
+                                  spilled[i]->labels.begin(), spilled[i]->labels.end());
+            delete spilled[i];
+            continue;
+        }
+        if (carried_labels.size() > 0)
+        {
+            spilled[i]->labels.insert(spilled[i]->labels.begin(),
+                                      carried_labels.begin(), carried_labels.end());
+            carried_labels.clear();
         }
+        code.push_back(spilled[i]);
     }
 }
\ No newline at end of file
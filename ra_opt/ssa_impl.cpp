@@ -0,0 +1,629 @@
+#include "basicblock.h"
+#include <algorithm>
+
+static bool is_conditional_jump(std::size_t instr)
+{
+    return instr == INSTR_JE || instr == INSTR_JNE || IS_COMPARE_JUMP(instr);
+}
+
+static void free_blocks(std::vector<BasicBlock*>& blocks)
+{
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
+
+/* Label of the first instruction of a block, created if it has none. */
+static std::size_t block_label(BasicBlock* block, NameSupply& names)
+{
+    auto head = block->code.front();
+    if (head->labels.size() == 0)
+        head->labels.push_back(names.new_label());
+    return head->labels.front();
+}
+
+/**
+ *  Delete the basic blocks that cannot be reached from the entry, and the
+ *  PHI operands that come from them.
+ */
+void Procedure::remove_unreachable_blocks()
+{
+    auto blocks = make_basic_blocks(code);
+    DominatorTree dom(blocks);
+    std::set<std::size_t> removed_labels;
+    for (std::size_t b = 0; b + 1 < blocks.size(); b++)
+    {
+        if (!dom.reachable(b))
+            removed_labels.insert(blocks[b]->code.front()->labels.begin(),
+                                  blocks[b]->code.front()->labels.end());
+    }
+    std::vector<IntermediateCode*> reachable;
+    for (std::size_t b = 0; b + 1 < blocks.size(); b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (!dom.reachable(b))
+            {
+                delete code_line;
+                continue;
+            }
+            auto& args = code_line->phi_args;
+            args.erase(std::remove_if(args.begin(), args.end(),
+                                      [&removed_labels](const std::pair<std::size_t, std::size_t>& arg)
+                                      {
+                                          return removed_labels.count(arg.first) > 0;
+                                      }),
+                       args.end());
+            reachable.push_back(code_line);
+        }
+    }
+    code.swap(reachable);
+    free_blocks(blocks);
+}
+
+/**
+ *  Dominance frontier of every basic block: the blocks where the dominance
+ *  of the block ends, i.e. those with a predecessor that it dominates, which
+ *  they are not strictly dominated by.
+ */
+static std::vector<std::set<std::size_t>> dominance_frontiers(const std::vector<BasicBlock*>& blocks,
+                                                             DominatorTree& dom)
+{
+    std::vector<std::set<std::size_t>> frontier(blocks.size());
+    for (std::size_t b = 0; b < blocks.size(); b++)
+    {
+        if (!dom.reachable(b) || blocks[b]->predecessors.size() < 2)
+            continue;
+        for (auto& p: blocks[b]->predecessors)
+        {
+            if (!dom.reachable(p))
+                continue;
+            for (auto runner = p; runner != dom.idom[b]; runner = dom.idom[runner])
+            {
+                frontier[runner].insert(b);
+            }
+        }
+    }
+    return frontier;
+}
+
+/**
+ *  Translate the procedure into SSA form, where every register is written
+ *  by exactly one instruction, and that instruction dominates every read of
+ *  the register (a read by a PHI counts as a read at the end of the block it
+ *  comes from).
+ *
+ *  PHIs are placed by the algorithm of Cytron et al.: a register written in
+ *  a block needs a PHI in every block of the iterated dominance frontier of
+ *  the blocks writing it. A PHI is only placed where the register is live,
+ *  so that no dead PHI is created. Registers are then renamed along a walk
+ *  of the dominator tree, each write getting a new register from 'names'. A
+ *  read without any write before it keeps the old (undefined) register.
+ *
+ *  Unreachable blocks are deleted, and every block gets a label, by which
+ *  the PHIs of its successors name it. The entry block gets no PHI: if it
+ *  is jumped to, a jump to it is placed before it as the new entry.
+ */
+void Procedure::to_ssa(NameSupply& names)
+{
+    remove_unreachable_blocks();
+    auto blocks = make_basic_blocks(code);
+    if (blocks[0]->predecessors.size() > 0)
+    {
+        code.insert(code.begin(), new IntermediateCode(
+            INSTR_JMP, PLACEHOLDER, PLACEHOLDER, block_label(blocks[0], names)
+        ));
+        free_blocks(blocks);
+        blocks = make_basic_blocks(code);
+    }
+    /* The last block is the empty exit block, which gets no PHI. */
+    auto num_blocks = blocks.size() - 1;
+    std::vector<std::size_t> label(num_blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        label[b] = block_label(blocks[b], names);
+    }
+
+    DominatorTree dom(blocks);
+    auto frontier = dominance_frontiers(blocks, dom);
+    LivenessUpdater updater(blocks);
+    updater.calculate_liveness();
+
+    /* Blocks that write each register. */
+    std::map<std::size_t, std::set<std::size_t>> def_blocks;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            for (auto& reg: def(code_line))
+            {
+                def_blocks[reg].insert(b);
+            }
+        }
+    }
+
+    /* PHIs of every block, and the register each one merges. */
+    std::vector<std::vector<IntermediateCode*>> phis(num_blocks);
+    std::map<IntermediateCode*, std::size_t> phi_reg;
+    for (auto& pair: def_blocks)
+    {
+        auto reg = pair.first;
+        std::vector<std::size_t> work(pair.second.begin(), pair.second.end());
+        std::set<std::size_t> visited;
+        while (work.size() > 0)
+        {
+            auto b = work.back();
+            work.pop_back();
+            for (auto& f: frontier[b])
+            {
+                if (f >= num_blocks || !visited.insert(f).second)
+                    continue;
+                /* The liveness at the entry of a block is the last one. */
+                if (updater.liveness[f].back().count(reg) == 0)
+                    continue;
+                auto phi = new IntermediateCode(INSTR_PHI, reg, PLACEHOLDER, PLACEHOLDER);
+                for (auto& p: blocks[f]->predecessors)
+                {
+                    phi->phi_args.push_back({label[p], reg});
+                }
+                phis[f].push_back(phi);
+                phi_reg[phi] = reg;
+                if (pair.second.count(f) == 0)
+                    work.push_back(f);
+            }
+        }
+    }
+
+    /* Rename registers in a preorder walk of the dominator tree. 'stacks'
+       maps a register to its new names in the blocks on the path from the
+       entry, and 'pushed[b]' lists the registers renamed in block 'b'. */
+    std::map<std::size_t, std::vector<std::size_t>> stacks;
+    std::vector<std::vector<std::size_t>> pushed(num_blocks);
+    auto rename_def = [&](std::size_t b, std::size_t* field)
+    {
+        auto reg = names.new_register();
+        stacks[*field].push_back(reg);
+        pushed[b].push_back(*field);
+        *field = reg;
+    };
+    auto rename_block = [&](std::size_t b)
+    {
+        for (auto& phi: phis[b])
+        {
+            rename_def(b, &phi->dest);
+        }
+        for (auto& code_line: blocks[b]->code)
+        {
+            for (auto& field: use_fields(code_line))
+            {
+                auto it = stacks.find(*field);
+                if (it != stacks.end() && it->second.size() > 0)
+                    *field = it->second.back();
+            }
+            auto field = def_field(code_line);
+            if (field != nullptr)
+                rename_def(b, field);
+        }
+        for (auto& s: blocks[b]->successors)
+        {
+            if (s >= num_blocks)
+                continue;
+            for (auto& phi: phis[s])
+            {
+                auto& stack = stacks[phi_reg.at(phi)];
+                for (auto& arg: phi->phi_args)
+                {
+                    if (arg.first == label[b] && stack.size() > 0)
+                        arg.second = stack.back();
+                }
+            }
+        }
+    };
+    std::vector<std::pair<std::size_t, std::size_t>> walk = {{0, 0}};
+    rename_block(0);
+    while (walk.size() > 0)
+    {
+        auto& top = walk.back();
+        auto& children = dom.children[top.first];
+        if (top.second < children.size())
+        {
+            auto next = children[top.second++];
+            if (next >= num_blocks)
+                continue;
+            rename_block(next);
+            walk.push_back({next, 0});
+        }
+        else
+        {
+            for (auto& reg: pushed[top.first])
+            {
+                stacks[reg].pop_back();
+            }
+            walk.pop_back();
+        }
+    }
+
+    /* The PHIs go at the beginning of their blocks, and take the labels. */
+    std::vector<IntermediateCode*> ssa_code;
+    ssa_code.reserve(code.size());
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto& block_code = blocks[b]->code;
+        if (phis[b].size() > 0)
+        {
+            phis[b].front()->labels.swap(block_code.front()->labels);
+            ssa_code.insert(ssa_code.end(), phis[b].begin(), phis[b].end());
+        }
+        ssa_code.insert(ssa_code.end(), block_code.begin(), block_code.end());
+    }
+    code.swap(ssa_code);
+    free_blocks(blocks);
+}
+
+/**
+ *  Sequentialize a parallel copy, a list of (destination, source) pairs
+ *  whose sources are all read before any destination is written, into RRMOV
+ *  instructions. A copy is emitted once no other pending copy reads its
+ *  destination; if every pending copy is blocked, they form cycles, which
+ *  are broken by saving one destination to a new register first.
+ */
+static std::vector<IntermediateCode*> sequentialize(std::vector<std::pair<std::size_t, std::size_t>> copies,
+                                                    NameSupply& names)
+{
+    std::vector<IntermediateCode*> moves;
+    copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                [](const std::pair<std::size_t, std::size_t>& copy)
+                                {
+                                    return copy.first == copy.second;
+                                }),
+                 copies.end());
+    while (copies.size() > 0)
+    {
+        auto ready = copies.end();
+        for (auto it = copies.begin(); it != copies.end() && ready == copies.end(); it++)
+        {
+            ready = it;
+            for (auto& other: copies)
+            {
+                if (other.second == it->first)
+                {
+                    ready = copies.end();
+                    break;
+                }
+            }
+        }
+        if (ready != copies.end())
+        {
+            moves.push_back(new IntermediateCode(INSTR_RRMOV, ready->first, ready->second, PLACEHOLDER));
+            copies.erase(ready);
+            continue;
+        }
+        auto saved = copies.front().first;
+        auto temp = names.new_register();
+        moves.push_back(new IntermediateCode(INSTR_RRMOV, temp, saved, PLACEHOLDER));
+        for (auto& copy: copies)
+        {
+            if (copy.second == saved)
+                copy.second = temp;
+        }
+    }
+    return moves;
+}
+
+/**
+ *  Give the operands and the result of every PHI one register where their
+ *  live ranges do not overlap, so that the copies for the PHI are no-ops.
+ *
+ *  Liveness is computed with the meaning of PHIs in SSA form: a PHI operand
+ *  is read at the end of its predecessor, and a PHI result is written at the
+ *  beginning of its block. Two registers interfere if one is live where the
+ *  other is written. The registers of a PHI are merged into one class if no
+ *  two registers of the classes interfere.
+ */
+static void coalesce_phis(const std::vector<BasicBlock*>& blocks, std::size_t num_blocks,
+                          const std::map<std::size_t, std::size_t>& block_of_label)
+{
+    /* Registers of the PHIs, which are the only ones to be merged. */
+    std::set<std::size_t> candidates;
+    /* Registers read by the PHIs of the successors of every block, and
+       written by the PHIs of every block. */
+    std::vector<std::set<std::size_t>> phi_uses(num_blocks), phi_defs(num_blocks);
+    std::vector<IntermediateCode*> phis;
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (code_line->instr != INSTR_PHI)
+                break;
+            phis.push_back(code_line);
+            phi_defs[b].insert(code_line->dest);
+            candidates.insert(code_line->dest);
+            for (auto& arg: code_line->phi_args)
+            {
+                phi_uses[block_of_label.at(arg.first)].insert(arg.second);
+                candidates.insert(arg.second);
+            }
+        }
+    }
+    if (phis.size() == 0)
+        return;
+
+    /* Registers read before being written, and written, by the instructions
+       of every block other than PHIs. */
+    std::vector<std::set<std::size_t>> upward(num_blocks), killed(num_blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (code_line->instr == INSTR_PHI)
+                continue;
+            for (auto& reg: use(code_line))
+            {
+                if (killed[b].count(reg) == 0)
+                    upward[b].insert(reg);
+            }
+            for (auto& reg: def(code_line))
+            {
+                killed[b].insert(reg);
+            }
+        }
+    }
+    std::vector<std::set<std::size_t>> live_in(num_blocks), live_out(num_blocks);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto b = num_blocks; b-- > 0; )
+        {
+            auto out = phi_uses[b];
+            for (auto& s: blocks[b]->successors)
+            {
+                if (s >= num_blocks)
+                    continue;
+                for (auto& reg: live_in[s])
+                {
+                    if (phi_defs[s].count(reg) == 0)
+                        out.insert(reg);
+                }
+            }
+            auto in = phi_defs[b];
+            in.insert(upward[b].begin(), upward[b].end());
+            for (auto& reg: out)
+            {
+                if (killed[b].count(reg) == 0)
+                    in.insert(reg);
+            }
+            if (in != live_in[b] || out != live_out[b])
+            {
+                live_in[b].swap(in);
+                live_out[b].swap(out);
+                changed = true;
+            }
+        }
+    }
+
+    std::set<std::pair<std::size_t, std::size_t>> interfere;
+    auto add_interference = [&](std::size_t reg, const std::set<std::size_t>& live)
+    {
+        if (candidates.count(reg) == 0)
+            return;
+        for (auto& other: live)
+        {
+            if (other != reg && candidates.count(other) > 0)
+                interfere.insert({std::min(reg, other), std::max(reg, other)});
+        }
+    };
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto live = live_out[b];
+        auto& block_code = blocks[b]->code;
+        for (auto it = block_code.rbegin(); it != block_code.rend() && (*it)->instr != INSTR_PHI; it++)
+        {
+            for (auto& reg: def(*it))
+            {
+                add_interference(reg, live);
+                live.erase(reg);
+            }
+            for (auto& reg: use(*it))
+            {
+                live.insert(reg);
+            }
+        }
+        for (auto& reg: phi_defs[b])
+        {
+            add_interference(reg, live_in[b]);
+        }
+    }
+
+    /* Merge classes, kept as lists of registers in 'members'. */
+    std::map<std::size_t, std::size_t> class_of;
+    std::map<std::size_t, std::vector<std::size_t>> members;
+    for (auto& reg: candidates)
+    {
+        class_of[reg] = reg;
+        members[reg] = {reg};
+    }
+    auto merge = [&](std::size_t a, std::size_t b)
+    {
+        a = class_of.at(a);
+        b = class_of.at(b);
+        if (a == b)
+            return;
+        for (auto& x: members[a])
+        {
+            for (auto& y: members[b])
+            {
+                if (interfere.count({std::min(x, y), std::max(x, y)}) > 0)
+                    return;
+            }
+        }
+        for (auto& y: members[b])
+        {
+            class_of[y] = a;
+            members[a].push_back(y);
+        }
+        members.erase(b);
+    };
+    for (auto& phi: phis)
+    {
+        for (auto& arg: phi->phi_args)
+        {
+            merge(phi->dest, arg.second);
+        }
+    }
+
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            for (auto& field: use_fields(code_line))
+            {
+                auto it = class_of.find(*field);
+                if (it != class_of.end())
+                    *field = it->second;
+            }
+            auto field = def_field(code_line);
+            if (field != nullptr)
+            {
+                auto it = class_of.find(*field);
+                if (it != class_of.end())
+                    *field = it->second;
+            }
+        }
+    }
+}
+
+/**
+ *  Translate the procedure out of SSA form. Every PHI becomes a copy on
+ *  each edge into its block: at the end of the predecessor if that is its
+ *  only successor, or on a new block splitting the edge otherwise. A new
+ *  block for a fall-through edge is placed before the block it falls to,
+ *  and one for a jump at the end of the procedure, jumping on to the block.
+ *  The copies on an edge are done in parallel, like the PHIs they replace.
+ *  Registers of a PHI are coalesced first where possible, so that most of
+ *  the copies, and the new blocks for them, are not needed.
+ *
+ *  Labels that no jump refers to are then deleted, since SSA construction
+ *  labels every block.
+ */
+void Procedure::from_ssa(NameSupply& names)
+{
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    auto block_of_label = block_of_labels(blocks);
+    coalesce_phis(blocks, num_blocks, block_of_label);
+
+    /* Copies to place at the end of every block, and on the new blocks for
+       the edges to the block following it and to its jump target. */
+    typedef std::vector<std::pair<std::size_t, std::size_t>> ParallelCopy;
+    std::vector<ParallelCopy> at_end(num_blocks), on_fall(num_blocks), on_jump(num_blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (code_line->instr != INSTR_PHI)
+                break;
+            std::set<std::size_t> seen;
+            for (auto& arg: code_line->phi_args)
+            {
+                auto p = block_of_label.at(arg.first);
+                if (!seen.insert(p).second)
+                    continue;
+                auto last = blocks[p]->code.back();
+                std::pair<std::size_t, std::size_t> copy = {code_line->dest, arg.second};
+                if (!is_conditional_jump(last->instr))
+                {
+                    at_end[p].push_back(copy);
+                    continue;
+                }
+                if (block_of_label.at(last->roperand) == b)
+                    on_jump[p].push_back(copy);
+                if (p + 1 == b)
+                    on_fall[p].push_back(copy);
+            }
+        }
+    }
+
+    std::vector<IntermediateCode*> out, split;
+    /* Labels of deleted PHIs, which go to the next instruction. */
+    std::vector<std::size_t> carried;
+    auto emit = [&out, &carried](IntermediateCode* code_line)
+    {
+        if (carried.size() > 0)
+        {
+            code_line->labels.insert(code_line->labels.begin(), carried.begin(), carried.end());
+            carried.clear();
+        }
+        out.push_back(code_line);
+    };
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        auto& block_code = blocks[b]->code;
+        /* A block may be left with PHIs only, and then falls through. */
+        auto last = block_code.back()->instr == INSTR_PHI ? nullptr : block_code.back();
+        for (auto& code_line: block_code)
+        {
+            if (code_line->instr == INSTR_PHI)
+            {
+                carried.insert(carried.end(), code_line->labels.begin(), code_line->labels.end());
+                delete code_line;
+                continue;
+            }
+            if (code_line == last && last->instr == INSTR_JMP)
+            {
+                carried.insert(carried.end(), last->labels.begin(), last->labels.end());
+                last->labels.clear();
+                for (auto& move: sequentialize(at_end[b], names))
+                {
+                    emit(move);
+                }
+            }
+            emit(code_line);
+        }
+        if (last == nullptr || last->instr != INSTR_JMP)
+        {
+            for (auto& move: sequentialize(at_end[b], names))
+            {
+                emit(move);
+            }
+        }
+        for (auto& move: sequentialize(on_fall[b], names))
+        {
+            emit(move);
+        }
+        auto moves = sequentialize(on_jump[b], names);
+        if (moves.size() > 0)
+        {
+            auto target = last->roperand;
+            last->roperand = names.new_label();
+            moves.front()->labels.push_back(last->roperand);
+            split.insert(split.end(), moves.begin(), moves.end());
+            split.push_back(new IntermediateCode(INSTR_JMP, PLACEHOLDER, PLACEHOLDER, target));
+        }
+    }
+    /* The procedure ends with a RET, so nothing falls into the new blocks. */
+    for (auto& code_line: split)
+    {
+        emit(code_line);
+    }
+    free_blocks(blocks);
+
+    std::set<std::size_t> targets;
+    for (auto& code_line: out)
+    {
+        if (code_line->instr == INSTR_JMP || is_conditional_jump(code_line->instr))
+            targets.insert(code_line->roperand);
+    }
+    for (auto& code_line: out)
+    {
+        auto& labels = code_line->labels;
+        labels.erase(std::remove_if(labels.begin(), labels.end(),
+                                    [&targets](std::size_t label)
+                                    {
+                                        return label < (1 << 30) && targets.count(label) == 0;
+                                    }),
+                     labels.end());
+    }
+    code.swap(out);
+}
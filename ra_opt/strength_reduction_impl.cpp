@@ -0,0 +1,247 @@
+#include "basicblock.h"
+#include <cstdint>
+
+/* Append an instruction to 'sequence', writing a new register unless
+   'dest' is given, and return the register written. */
+static std::size_t emit(std::vector<IntermediateCode*>& sequence, NameSupply& names,
+                        std::size_t instr, std::size_t dest, std::size_t loperand, std::size_t roperand)
+{
+    if (dest == PLACEHOLDER)
+        dest = names.new_register();
+    sequence.push_back(new IntermediateCode(instr, dest, loperand, roperand));
+    return dest;
+}
+
+static bool is_power_of_two(std::uint32_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static std::size_t exponent_of(std::uint32_t value)
+{
+    std::size_t k = 0;
+    while (value > 1)
+    {
+        value >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/**
+ *  Magic number 'm' and shift 's' of the signed division by 'd', which is
+ *  at least 3 and not a power of two (Hacker's Delight, chapter 10). The
+ *  quotient is the upper word of 'x * m', plus 'x' if 'm' is negative,
+ *  shifted right arithmetically by 's', plus 1 if 'x' is negative.
+ */
+static void division_magic(std::uint32_t d, std::int32_t& m, std::size_t& s)
+{
+    const std::uint32_t two31 = 0x80000000u;
+    std::uint32_t anc = two31 - 1 - two31 % d;
+    std::size_t p = 31;
+    std::uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    std::uint32_t q2 = two31 / d, r2 = two31 - q2 * d;
+    std::uint32_t delta;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d)
+        {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    m = (std::int32_t)(q2 + 1);
+    s = p - 32;
+}
+
+/**
+ *  Multiplication of register 'x' by the constant 'c' into 'dest', by
+ *  shifts and at most one addition or subtraction. Returns false if 'c'
+ *  needs more than that.
+ */
+static bool multiply_by(std::vector<IntermediateCode*>& sequence, NameSupply& names,
+                        std::size_t dest, std::size_t x, std::int32_t c)
+{
+    std::uint32_t a = (c < 0) ? 0u - (std::uint32_t)c : (std::uint32_t)c;
+    if (c == 0)
+        emit(sequence, names, INSTR_IRMOV, dest, 0, PLACEHOLDER);
+    else if (c == 1)
+        emit(sequence, names, INSTR_RRMOV, dest, x, PLACEHOLDER);
+    else if (c == -1)
+        emit(sequence, names, INSTR_NEG, dest, x, PLACEHOLDER);
+    else if (is_power_of_two(a))
+    {
+        if (c > 0)
+            emit(sequence, names, INSTR_SLL, dest, x, exponent_of(a));
+        else
+        {
+            auto shifted = emit(sequence, names, INSTR_SLL, PLACEHOLDER, x, exponent_of(a));
+            emit(sequence, names, INSTR_NEG, dest, shifted, PLACEHOLDER);
+        }
+    }
+    else if (is_power_of_two(a - 1) && c > 0)
+    {
+        auto shifted = emit(sequence, names, INSTR_SLL, PLACEHOLDER, x, exponent_of(a - 1));
+        emit(sequence, names, INSTR_ADD, dest, shifted, x);
+    }
+    else if (is_power_of_two(a + 1))
+    {
+        auto shifted = emit(sequence, names, INSTR_SLL, PLACEHOLDER, x, exponent_of(a + 1));
+        if (c > 0)
+            emit(sequence, names, INSTR_SUB, dest, shifted, x);
+        else
+            emit(sequence, names, INSTR_SUB, dest, x, shifted);
+    }
+    else
+        return false;
+    return true;
+}
+
+/**
+ *  Signed division of register 'x' by the constant 'd' into 'dest',
+ *  rounding toward zero. A power of two is a shift, after adding 'd - 1'
+ *  to a negative 'x'; other divisors multiply by a magic number. 'd' is
+ *  neither 0 nor INT_MIN.
+ */
+static void divide_by(std::vector<IntermediateCode*>& sequence, NameSupply& names,
+                      std::size_t dest, std::size_t x, std::int32_t d)
+{
+    if (d == 1)
+    {
+        emit(sequence, names, INSTR_RRMOV, dest, x, PLACEHOLDER);
+        return;
+    }
+    if (d == -1)
+    {
+        emit(sequence, names, INSTR_NEG, dest, x, PLACEHOLDER);
+        return;
+    }
+    std::uint32_t a = (d < 0) ? 0u - (std::uint32_t)d : (std::uint32_t)d;
+    auto quotient = (d < 0) ? PLACEHOLDER : dest;
+    if (is_power_of_two(a))
+    {
+        auto k = exponent_of(a);
+        /* '|d| - 1' if 'x' is negative, and 0 otherwise. */
+        std::size_t bias;
+        if (k == 1)
+            bias = emit(sequence, names, INSTR_SRL, PLACEHOLDER, x, 31);
+        else
+        {
+            auto sign = emit(sequence, names, INSTR_SRA, PLACEHOLDER, x, 31);
+            bias = emit(sequence, names, INSTR_SRL, PLACEHOLDER, sign, 32 - k);
+        }
+        auto biased = emit(sequence, names, INSTR_ADD, PLACEHOLDER, x, bias);
+        quotient = emit(sequence, names, INSTR_SRA, quotient, biased, k);
+    }
+    else
+    {
+        std::int32_t m;
+        std::size_t s;
+        division_magic(a, m, s);
+        auto magic = emit(sequence, names, INSTR_IRMOV, PLACEHOLDER, (std::size_t)m, PLACEHOLDER);
+        auto high = emit(sequence, names, INSTR_MULH, PLACEHOLDER, x, magic);
+        if (m < 0)
+            high = emit(sequence, names, INSTR_ADD, PLACEHOLDER, high, x);
+        if (s > 0)
+            high = emit(sequence, names, INSTR_SRA, PLACEHOLDER, high, s);
+        auto sign = emit(sequence, names, INSTR_SRL, PLACEHOLDER, x, 31);
+        quotient = emit(sequence, names, INSTR_ADD, quotient, high, sign);
+    }
+    if (d < 0)
+        emit(sequence, names, INSTR_NEG, dest, quotient, PLACEHOLDER);
+}
+
+/**
+ *  Remainder of the signed division of register 'x' by the constant 'd'
+ *  into 'dest', which has the sign of 'x', as 'x - x / |d| * |d|'. 'd' is
+ *  neither 0 nor INT_MIN.
+ */
+static void remainder_by(std::vector<IntermediateCode*>& sequence, NameSupply& names,
+                         std::size_t dest, std::size_t x, std::int32_t d)
+{
+    std::int32_t a = (d < 0) ? -d : d;
+    if (a == 1)
+    {
+        emit(sequence, names, INSTR_IRMOV, dest, 0, PLACEHOLDER);
+        return;
+    }
+    auto quotient = names.new_register();
+    divide_by(sequence, names, quotient, x, a);
+    auto product = names.new_register();
+    if (!multiply_by(sequence, names, product, quotient, a))
+    {
+        auto constant = emit(sequence, names, INSTR_IRMOV, PLACEHOLDER, (std::size_t)a, PLACEHOLDER);
+        emit(sequence, names, INSTR_MUL, product, quotient, constant);
+    }
+    emit(sequence, names, INSTR_SUB, dest, x, product);
+}
+
+/**
+ *  Strength reduction of multiplications, divisions and remainders by
+ *  constants, on the SSA form of the procedure, where an operand is a
+ *  constant if it is written by an IRMOV.
+ *
+ *  A multiplication becomes shifts and at most one addition, if that is
+ *  enough, and otherwise stays a 'mul'. A division or remainder by a
+ *  constant other than 0 and INT_MIN never stays a 'div' or 'rem', which
+ *  take tens of cycles: powers of two become shifts fixed up for negative
+ *  dividends, and other divisors a 'mulh' by a magic number, with the
+ *  truncation toward zero of C. The IRMOVs of the constants are left to
+ *  dead code elimination.
+ */
+void Procedure::reduce_strength(NameSupply& names)
+{
+    std::map<std::size_t, std::int32_t> constant;
+    for (auto& code_line: code)
+    {
+        if (code_line->instr == INSTR_IRMOV && code_line->roperand != ADDR)
+            constant[code_line->dest] = (std::int32_t)code_line->loperand;
+    }
+
+    std::vector<IntermediateCode*> reduced;
+    reduced.reserve(code.size());
+    for (auto& code_line: code)
+    {
+        std::vector<IntermediateCode*> sequence;
+        auto l = constant.find(code_line->loperand), r = constant.find(code_line->roperand);
+        switch (code_line->instr)
+        {
+            case INSTR_MUL:
+                if (r != constant.end())
+                    multiply_by(sequence, names, code_line->dest, code_line->loperand, r->second);
+                else if (l != constant.end())
+                    multiply_by(sequence, names, code_line->dest, code_line->roperand, l->second);
+                break;
+            case INSTR_DIV:
+                if (r != constant.end() && r->second != 0 && r->second != INT32_MIN)
+                    divide_by(sequence, names, code_line->dest, code_line->loperand, r->second);
+                break;
+            case INSTR_MOD:
+                if (r != constant.end() && r->second != 0 && r->second != INT32_MIN)
+                    remainder_by(sequence, names, code_line->dest, code_line->loperand, r->second);
+                break;
+            default:
+                break;
+        }
+        if (sequence.size() == 0)
+        {
+            reduced.push_back(code_line);
+            continue;
+        }
+        sequence.front()->labels.swap(code_line->labels);
+        delete code_line;
+        reduced.insert(reduced.end(), sequence.begin(), sequence.end());
+    }
+    code.swap(reduced);
+}
@@ -0,0 +1,206 @@
+#include "basicblock.h"
+#include <tuple>
+#include <algorithm>
+
+/* An expression computed by an instruction: the instruction and its
+   operands, either registers (by value number) or immediates. */
+typedef std::tuple<std::size_t, std::size_t, std::size_t> Expression;
+
+static bool is_commutative(std::size_t instr)
+{
+    return instr == INSTR_ADD || instr == INSTR_MUL || instr == INSTR_EQ || instr == INSTR_NEQ;
+}
+
+/**
+ *  Global value numbering on the SSA form of the procedure, by a preorder
+ *  walk of the dominator tree with a scoped table of the expressions
+ *  computed on the path from the entry.
+ *
+ *  The value number of a register is the register that first computed its
+ *  value: an instruction computing an expression already in the table gets
+ *  the number of the register there, which dominates it, and so does a copy
+ *  of a register, or a PHI merging one value (apart from itself), or the
+ *  same values from the same blocks as another PHI of its block. Operands
+ *  of commutative operations are ordered, and 'a > b' is numbered as
+ *  'b < a'. Only instructions without side effects or memory accesses
+ *  (IRMOV, arithmetic and comparisons) are numbered.
+ *
+ *  Every read of a register is then replaced by its value number, which
+ *  leaves the redundant instructions to dead code elimination.
+ */
+void Procedure::number_values()
+{
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    DominatorTree dom(blocks);
+
+    std::map<std::size_t, std::size_t> number;
+    auto number_of = [&number](std::size_t reg)
+    {
+        auto it = number.find(reg);
+        return it == number.end() ? reg : it->second;
+    };
+    std::map<Expression, std::size_t> table;
+    /* Expressions added to 'table' by every block on the walk. */
+    std::vector<std::vector<Expression>> added(num_blocks);
+
+    auto visit = [&](std::size_t b)
+    {
+        std::vector<IntermediateCode*> phis;
+        for (auto& code_line: blocks[b]->code)
+        {
+            if (code_line->instr == INSTR_PHI)
+            {
+                std::size_t same = 0;
+                bool trivial = true;
+                for (auto& arg: code_line->phi_args)
+                {
+                    auto value = number_of(arg.second);
+                    if (value == code_line->dest)
+                        continue;
+                    if (same != 0 && value != same)
+                        trivial = false;
+                    same = value;
+                }
+                if (trivial && same != 0)
+                {
+                    number[code_line->dest] = same;
+                    continue;
+                }
+                for (auto& other: phis)
+                {
+                    if (other->phi_args.size() == code_line->phi_args.size() &&
+                        std::equal(other->phi_args.begin(), other->phi_args.end(),
+                                   code_line->phi_args.begin(),
+                                   [&](const std::pair<std::size_t, std::size_t>& x,
+                                       const std::pair<std::size_t, std::size_t>& y)
+                                   {
+                                       return x.first == y.first &&
+                                              number_of(x.second) == number_of(y.second);
+                                   }))
+                    {
+                        number[code_line->dest] = other->dest;
+                        break;
+                    }
+                }
+                if (number.count(code_line->dest) == 0)
+                    phis.push_back(code_line);
+                continue;
+            }
+
+            auto instr = code_line->instr;
+            Expression expr;
+            switch (instr)
+            {
+                case INSTR_RRMOV:
+                    number[code_line->dest] = number_of(code_line->loperand);
+                    continue;
+                case INSTR_IRMOV:
+                    expr = Expression(instr, code_line->loperand, code_line->roperand);
+                    break;
+                case INSTR_NEG:
+                case INSTR_NOT:
+                case INSTR_BOOL:
+                    expr = Expression(instr, number_of(code_line->loperand), 0);
+                    break;
+                case INSTR_ADD:
+                case INSTR_SUB:
+                case INSTR_MUL:
+                case INSTR_DIV:
+                case INSTR_MOD:
+                case INSTR_GT:
+                case INSTR_GEQ:
+                case INSTR_LT:
+                case INSTR_LEQ:
+                case INSTR_EQ:
+                case INSTR_NEQ:
+                {
+                    auto l = number_of(code_line->loperand), r = number_of(code_line->roperand);
+                    if (instr == INSTR_GT || instr == INSTR_GEQ)
+                    {
+                        instr = (instr == INSTR_GT) ? INSTR_LT : INSTR_LEQ;
+                        std::swap(l, r);
+                    }
+                    if (is_commutative(instr) && l > r)
+                        std::swap(l, r);
+                    expr = Expression(instr, l, r);
+                    break;
+                }
+                default:
+                    continue;
+            }
+            auto it = table.find(expr);
+            if (it != table.end())
+                number[code_line->dest] = it->second;
+            else
+            {
+                table[expr] = code_line->dest;
+                added[b].push_back(expr);
+            }
+        }
+    };
+
+    std::vector<std::pair<std::size_t, std::size_t>> walk = {{0, 0}};
+    visit(0);
+    while (walk.size() > 0)
+    {
+        auto& top = walk.back();
+        auto& children = dom.children[top.first];
+        if (top.second < children.size())
+        {
+            auto next = children[top.second++];
+            if (next >= num_blocks)
+                continue;
+            visit(next);
+            walk.push_back({next, 0});
+        }
+        else
+        {
+            for (auto& expr: added[top.first])
+            {
+                table.erase(expr);
+            }
+            walk.pop_back();
+        }
+    }
+
+    /* A PHI may have been numbered by a register of a block not visited
+       yet, which got a number of its own later. */
+    auto resolve = [&number](std::size_t reg)
+    {
+        for (auto it = number.find(reg); it != number.end() && it->second != reg; it = number.find(reg))
+        {
+            reg = it->second;
+        }
+        return reg;
+    };
+    std::map<std::size_t, IntermediateCode*> constant_of;
+    for (auto& code_line: code)
+    {
+        if (code_line->instr == INSTR_IRMOV)
+            constant_of[code_line->dest] = code_line;
+    }
+    /* Reads of a constant are not replaced by the register of its first
+       IRMOV, which would then live across the whole procedure, instead of
+       being loaded next to its uses. A copy of a constant loads it itself. */
+    for (auto& code_line: code)
+    {
+        for (auto& field: use_fields(code_line))
+        {
+            auto reg = resolve(*field);
+            auto it = constant_of.find(reg);
+            if (it == constant_of.end())
+                *field = reg;
+            else if (code_line->instr == INSTR_RRMOV)
+            {
+                code_line->instr = INSTR_IRMOV;
+                code_line->loperand = it->second->loperand;
+                code_line->roperand = it->second->roperand;
+            }
+        }
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+}
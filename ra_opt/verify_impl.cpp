@@ -0,0 +1,82 @@
+#include "basicblock.h"
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef VERIFY_IR
+static void fail(const char* pass, const char* what, std::size_t operand)
+{
+    fprintf(stderr, "Internal error: after %s, %s (%lu)!\n", pass, what, (unsigned long)operand);
+    exit(5);
+}
+#endif
+
+/**
+ *  Check the control flow graph and the SSA form of the procedure after the
+ *  pass 'pass', and stop the compiler if they are broken: every jump goes to
+ *  a label of the procedure, PHIs come first in their blocks, and every PHI
+ *  has one operand for every edge from a predecessor of its block, named by
+ *  a label of the first instruction of the predecessor. Passes that join or split
+ *  blocks must keep the operands of the PHIs after them in step.
+ *
+ *  The checks rebuild the blocks after every pass, so they are only compiled
+ *  in with VERIFY_IR defined ('make VERIFY=1'); otherwise this does nothing.
+ */
+void Procedure::verify(const char* pass)
+{
+#ifdef VERIFY_IR
+    auto blocks = make_basic_blocks(code);
+    auto num_blocks = blocks.size() - 1;
+    auto block_of_label = block_of_labels(blocks);
+    for (std::size_t b = 0; b < num_blocks; b++)
+    {
+        /* Labels of the first instructions of the predecessors. */
+        std::map<std::size_t, std::size_t> pred_of_label;
+        for (auto& pred: blocks[b]->predecessors)
+        {
+            for (auto& label: blocks[pred]->code.front()->labels)
+            {
+                pred_of_label[label] = pred;
+            }
+        }
+        bool phis = true;
+        for (auto& code_line: blocks[b]->code)
+        {
+            if ((code_line->instr == INSTR_JMP || code_line->instr == INSTR_JE ||
+                 code_line->instr == INSTR_JNE || IS_COMPARE_JUMP(code_line->instr)) &&
+                block_of_label.count(code_line->roperand) == 0)
+                fail(pass, "a jump goes to no instruction", code_line->roperand);
+            if (code_line->instr != INSTR_PHI)
+            {
+                phis = false;
+                continue;
+            }
+            if (!phis)
+                fail(pass, "a PHI follows other instructions", code_line->dest);
+            /* A block that both jumps and falls through to this one is its
+               predecessor twice, with an operand for each edge. */
+            std::map<std::size_t, std::size_t> missing;
+            for (auto& pred: blocks[b]->predecessors)
+            {
+                missing[pred]++;
+            }
+            for (auto& arg: code_line->phi_args)
+            {
+                auto it = pred_of_label.find(arg.first);
+                if (it == pred_of_label.end())
+                    fail(pass, "a PHI operand comes from no predecessor", arg.first);
+                if (missing[it->second]-- == 0)
+                    fail(pass, "a PHI has more operands than edges from a predecessor", arg.first);
+            }
+            for (auto& pair: missing)
+            {
+                if (pair.second != 0)
+                    fail(pass, "a PHI misses the operand of a predecessor", code_line->dest);
+            }
+        }
+    }
+    for (auto& b: blocks)
+    {
+        delete b;
+    }
+#endif
+}
@@ -0,0 +1,85 @@
+#!/bin/sh
+# Compile every program in test/programs and compare what it prints, and
+# its exit code on a last line, with NAME.out. NAME.in, if present, is its
+# standard input.
+#
+# The assembly is run by $SYSY_RUN, called as '$SYSY_RUN NAME.s', which
+# must assemble and link it with the SysY runtime library, run it, and exit
+# with its exit code; by default it is test/run_riscv.sh.
+#
+# NAME.check, if present, checks the shape of the assembly. Each of its
+# lines, other than blank lines and '#' comments, is 'FUNCTION PATTERN' or
+# 'FUNCTION ! PATTERN': the assembly of FUNCTION, with its lines joined by
+# '; ', must or must not match the extended regular expression PATTERN.
+
+cd "$(dirname "$0")/.." || exit 1
+COMPILER=${COMPILER:-./compiler}
+SYSY_RUN=${SYSY_RUN:-test/run_riscv.sh}
+OUT_DIR=${OUT_DIR:-test/out}
+mkdir -p "$OUT_DIR"
+
+# Print the assembly of function $1 in file $2 on one line.
+function_asm()
+{
+    awk -v f="$1:" '$0 == f { on = 1; next } /^  \.(text|data|globl)/ { on = 0 }
+                    on { sub(/^ +/, ""); printf "%s; ", $0 }' "$2"
+}
+
+# Check the assembly $2 against the checks of file $1.
+check_asm()
+{
+    status=0
+    while read -r func pattern; do
+        case "$func" in
+            ''|'#'*) continue ;;
+        esac
+        case "$pattern" in
+            '! '*) want=no; pattern=${pattern#! } ;;
+            *) want=yes ;;
+        esac
+        if function_asm "$func" "$2" | grep -Eq -e "$pattern"; then
+            found=yes
+        else
+            found=no
+        fi
+        if [ $found != $want ]; then
+            printf "  %s: '%s' %s\n" "$func" "$pattern" "$([ $want = yes ] && echo not found || echo found)"
+            status=1
+        fi
+    done < "$1"
+    return $status
+}
+
+pass=0
+fail=0
+for src in test/programs/*.sy; do
+    name=$(basename "$src" .sy)
+    input=test/programs/$name.in
+    [ -f "$input" ] || input=/dev/null
+    if ! "$COMPILER" -riscv "$src" -o "$OUT_DIR/$name.s" 2> "$OUT_DIR/$name.err"; then
+        echo "FAIL $name: compilation failed"
+        fail=$((fail + 1))
+        continue
+    fi
+    $SYSY_RUN "$OUT_DIR/$name.s" < "$input" > "$OUT_DIR/$name.stdout" 2>> "$OUT_DIR/$name.err"
+    code=$?
+    {
+        cat "$OUT_DIR/$name.stdout"
+        if [ -s "$OUT_DIR/$name.stdout" ] && [ "$(tail -c 1 "$OUT_DIR/$name.stdout")" != "" ]; then
+            echo
+        fi
+        echo $code
+    } > "$OUT_DIR/$name.actual"
+    if ! cmp -s "$OUT_DIR/$name.actual" "test/programs/$name.out"; then
+        echo "FAIL $name: output differs"
+        fail=$((fail + 1))
+    elif [ -f "test/programs/$name.check" ] &&
+         ! check_asm "test/programs/$name.check" "$OUT_DIR/$name.s"; then
+        echo "FAIL $name: assembly differs"
+        fail=$((fail + 1))
+    else
+        pass=$((pass + 1))
+    fi
+done
+echo "passed $pass, failed $fail"
+[ $fail -eq 0 ]
@@ -0,0 +1,10 @@
+#!/bin/sh
+# Assemble and link a RISC-V assembly file with the SysY runtime library
+# (libsysy.a in $SYSY_LIB_DIR), then run it under QEMU user emulation.
+
+asm=$1
+obj=${asm%.s}.o
+exe=${asm%.s}.bin
+clang "$asm" -c -o "$obj" -target riscv32-unknown-linux-elf -march=rv32im -mabi=ilp32 || exit 125
+ld.lld "$obj" -L"${SYSY_LIB_DIR:-$CDE_LIBRARY_PATH/riscv32}" -lsysy -o "$exe" || exit 125
+exec qemu-riscv32-static "$exe"